@@ -8,20 +8,21 @@
 
 int main() {
 
-    init();
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
 
     // Make some directories and subdirectories
-	make_dir("/usr");
-	make_dir("/bin");
-	make_dir("/usr/resources");
+	make_dir(fs, "/usr");
+	make_dir(fs, "/bin");
+	make_dir(fs, "/usr/resources");
 
     // Make a data file
 	unsigned char* data = malloc(512);
     memset(data, 10, 512);
-    make_datafile("/usr/resources/foo", data, 512);
+    make_datafile(fs, "/usr/resources/foo", data, 512);
 
     // Read the above file
-    unsigned char* buffer = read_file("/usr/resources/foo");
+    unsigned char* buffer = read_file(fs, "/usr/resources/foo");
     for (int i=0; i<16; i++) {
         printf("%02X ", buffer[i]);
     } printf("...\n\n");
@@ -32,9 +33,9 @@ int main() {
     // Let's go bigger! (Reading/writing a multi-block data file)
     unsigned char* big_data = malloc(2048);
     memset(big_data, 10, 2048);
-    make_datafile("/bin/largeboi", big_data, 2048);
+    make_datafile(fs, "/bin/largeboi", big_data, 2048);
 
-    unsigned char* big_buffer = read_file("/bin/largeboi");
+    unsigned char* big_buffer = read_file(fs, "/bin/largeboi");
 
     // Just reading the start and end of the file
     printf("Start of the file: ");
@@ -47,5 +48,80 @@ int main() {
         printf("%02x ", big_buffer[i]);
     } printf("END\n\n");
 
+    llfs_unmount(fs);
+
+    // A directory with thousands of entries, whose blocks split many times
+    // as it fills. Every name is still there after remounting, and deleting
+    // every third one empties slots in buckets on both sides of each split.
+    fs = llfs_mount("../disk/vdisk");
+    init_fs(fs, 512, 8192, 2100);
+    make_dir(fs, "/many");
+
+    char name[64];
+    for (int i=0; i<2000; i++) {
+        sprintf(name, "/many/entry%d", i);
+        make_datafile(fs, name, (unsigned char*)&i, sizeof(int));
+    }
+    llfs_unmount(fs);
+
+    fs = llfs_mount("../disk/vdisk");
+    int found = 0;
+    for (int i=0; i<2000; i++) {
+        sprintf(name, "/many/entry%d", i);
+        buffer = read_file(fs, name);
+        found += memcmp(buffer, &i, sizeof(int)) == 0;
+        free(buffer);
+    }
+    printf("All 2000 entries found after remounting: %s\n\n", found == 2000 ? "OK" : "MISSING");
+
+    for (int i=0; i<2000; i+=3) {
+        sprintf(name, "/many/entry%d", i);
+        delete_file(fs, name);
+    }
+    found = 0;
+    for (int i=0; i<2000; i++) {
+        if (i % 3 != 0) {
+            sprintf(name, "/many/entry%d", i);
+            buffer = read_file(fs, name);
+            found += memcmp(buffer, &i, sizeof(int)) == 0;
+            free(buffer);
+        }
+    }
+    printf("The other 1333 entries survive the deletes: %s\n\n", found == 1333 ? "OK" : "MISSING");
+
+    // The deleted names can be made again, in the slots they left
+    for (int i=0; i<2000; i+=3) {
+        sprintf(name, "/many/entry%d", i);
+        make_datafile(fs, name, (unsigned char*)&i, sizeof(int));
+    }
+    llfs_unmount(fs);
+
+    fs = llfs_mount("../disk/vdisk");
+    found = 0;
+    for (int i=0; i<2000; i++) {
+        sprintf(name, "/many/entry%d", i);
+        buffer = read_file(fs, name);
+        found += memcmp(buffer, &i, sizeof(int)) == 0;
+        free(buffer);
+    }
+    printf("All 2000 entries found again: %s\n\n", found == 2000 ? "OK" : "MISSING");
+
+    // A path of 20 directories and well over 128 bytes: there's no limit
+    // on how long a path is or how many parts it has
+    char deep[512] = "";
+    for (int i=0; i<20; i++) {
+        sprintf(deep + strlen(deep), "/subdirectory%02d", i);
+        make_dir(fs, deep);
+    }
+    strcat(deep, "/deep_file");
+    memset(big_data, 'd', 2048);
+    make_datafile(fs, deep, big_data, 2048);
+
+    buffer = read_file(fs, deep);
+    printf("Read back through a %d-byte path: %s\n\n", (int)strlen(deep),
+            memcmp(buffer, big_data, 2048) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    llfs_unmount(fs);
     return 1;
 }
\ No newline at end of file
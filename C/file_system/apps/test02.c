@@ -9,15 +9,17 @@
 
 int main() {
 
-    init();
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
 
     printf("\nPrinting superblock...");
-    print_block(0);
+    print_block(fs, 0);
     printf("\n");
 
     printf("\nPrinting the free-block vector...");
-    print_block(1);
+    print_block(fs, 1);
     printf("\n");
 
+    llfs_unmount(fs);
     return 1;
 }
\ No newline at end of file
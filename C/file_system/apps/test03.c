@@ -8,33 +8,56 @@
 
 int main() {
 
-    init();
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
 
     // Making some directories
-    make_dir("/usr");
-	make_dir("/bin");
-	make_dir("/usr/resources");
-    make_dir("/bin/stuff");
+    make_dir(fs, "/usr");
+	make_dir(fs, "/bin");
+	make_dir(fs, "/usr/resources");
+    make_dir(fs, "/bin/stuff");
 
     // Making a data file
 	unsigned char* data = malloc(512);
     memset(data, 10, 512);
-    make_datafile("/usr/resources/foo", data, 512);
+    make_datafile(fs, "/usr/resources/foo", data, 512);
+
+    // Looking it up leaves its directory's path in the path cache
+    unsigned char* buffer = read_file(fs, "/usr/resources/foo");
+    free(buffer);
 
     printf("\nTake note of the free-block vector:");
-    print_block(1);
+    print_block(fs, 1);
     printf("\n\n");
 
     // Deleting a directory that has subfiles
-    delete_file("/usr/resources");
+    delete_file(fs, "/usr/resources");
 
     printf("\nHere's how the free-block vector looks after that directory deletion:");
-    print_block(1);
+    print_block(fs, 1);
     printf("\n\n");
 
+    // Another directory takes the freed inode, and making this one again
+    // gives it a new one. The path leads there now, not to the inode it
+    // was cached with before the deletion: after a remount, which starts
+    // the caches empty, the new file is where it should be.
+    make_dir(fs, "/bin/other");
+    make_dir(fs, "/usr/resources");
+    memset(data, 20, 512);
+    make_datafile(fs, "/usr/resources/foo", data, 512);
+    llfs_unmount(fs);
+
+    fs = llfs_mount("../disk/vdisk");
+    buffer = read_file(fs, "/usr/resources/foo");
+    printf("The path leads to the new file: %s\n\n", memcmp(buffer, data, 512) == 0 ? "OK" : "STALE");
+    free(buffer);
+
+    delete_file(fs, "/usr/resources");
+
     // We can no longer read the subfile, since it has been deleted.
     // The file system intentionally exits after a bad read call. 
-    read_file("/usr/resources/foo");
+    read_file(fs, "/usr/resources/foo");
 
+    llfs_unmount(fs);
     return 1;
 }
\ No newline at end of file
@@ -3,33 +3,117 @@
 #include <string.h>
 
 #include "../io/File.h"
+#include "../disk/disk.h"
 
 // More on file deletion, and how blocks and inode slots get recycled
 
+// Copy the free-block vector off the disk image, with nothing mounted
+void read_fbv(unsigned char* fbv) {
+
+    struct disk* disk = open_disk("../disk/vdisk");
+    read_block(disk, 1, fbv);
+    close_disk(disk);
+}
+
 int main() {
 
-    init();
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
 
     // Making some directories
-    make_dir("/usr");
-	make_dir("/bin");
-	make_dir("/usr/resources");
-    make_dir("/bin/stuff");
+    make_dir(fs, "/usr");
+	make_dir(fs, "/bin");
+	make_dir(fs, "/usr/resources");
+    make_dir(fs, "/bin/stuff");
 
     // Making a multi-block data file
 	unsigned char* data = malloc(1024);
     memset(data, 10, 1024);
-    make_datafile("/usr/resources/foo", data, 1024);
+    make_datafile(fs, "/usr/resources/foo", data, 1024);
 
     // Deleting a superdirectory
-    delete_file("/usr");
+    delete_file(fs, "/usr");
 
     // Making some new files, which re-use freed resources.
-    make_dir("/new_usr");
-    make_dir("/new_usr/more_resources");
-    make_datafile("/new_usr/more_resources/bar", data, 1024);
+    make_dir(fs, "/new_usr");
+    make_dir(fs, "/new_usr/more_resources");
+    make_datafile(fs, "/new_usr/more_resources/bar", data, 1024);
 
     printf("Notice how new files recycle the deleted inode slots and storage blocks!\n\n");
 
+    llfs_unmount(fs);
+
+    // Files whose blocks run across several 64-bit words of the free-block
+    // vector. Deleting them gives every one of those blocks back, so the
+    // FBV ends up just as it was before they were made.
+    fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
+    llfs_unmount(fs);
+
+    unsigned char fbv_before[512];
+    unsigned char fbv_after[512];
+    read_fbv(fbv_before);
+
+    fs = llfs_mount("../disk/vdisk");
+    make_dir(fs, "/spread");
+
+    unsigned char* spread = malloc(12 * 512);
+    char path[32];
+    int ok = 1;
+    for (int i=0; i<8; i++) {
+        memset(spread, 'a' + i, 12 * 512);
+        sprintf(path, "/spread/f%d", i);
+        make_datafile(fs, path, spread, 12 * 512);
+    }
+    for (int i=0; i<8; i++) {
+        memset(spread, 'a' + i, 12 * 512);
+        sprintf(path, "/spread/f%d", i);
+        unsigned char* buffer = read_file(fs, path);
+        ok &= memcmp(buffer, spread, 12 * 512) == 0;
+        free(buffer);
+    }
+    printf("Files across word boundaries read back: %s\n\n", ok ? "OK" : "CORRUPTED");
+
+    delete_file(fs, "/spread");
+    llfs_unmount(fs);
+
+    read_fbv(fbv_after);
+    printf("FBV after deleting them: %s\n\n",
+            memcmp(fbv_before, fbv_after, 512) == 0 ? "OK" : "LEAKED");
+    free(spread);
+
+    // Over 100 files, more than one 64-bit word of the inode bitmap holds,
+    // on a disk with 128 inodes. Making them all a second time only works
+    // if deleting them gave every inode back.
+    fs = llfs_mount("../disk/vdisk");
+    init_fs(fs, 512, 4096, 128);
+    for (int round=0; round<2; round++) {
+        for (int d=0; d<10; d++) {
+            sprintf(path, "/d%d", d);
+            make_dir(fs, path);
+            for (int f=0; f<10; f++) {
+                sprintf(path, "/d%d/f%d", d, f);
+                make_datafile(fs, path, (unsigned char*)path, strlen(path) + 1);
+            }
+        }
+
+        ok = 1;
+        for (int d=0; d<10; d++) {
+            for (int f=0; f<10; f++) {
+                sprintf(path, "/d%d/f%d", d, f);
+                unsigned char* buffer = read_file(fs, path);
+                ok &= strcmp((char*)buffer, path) == 0;
+                free(buffer);
+            }
+        }
+        printf("Round %d, 110 inodes in use: %s\n\n", round + 1, ok ? "OK" : "CORRUPTED");
+
+        for (int d=0; d<10; d++) {
+            sprintf(path, "/d%d", d);
+            delete_file(fs, path);
+        }
+    }
+    llfs_unmount(fs);
+
     return 1;
 }
\ No newline at end of file
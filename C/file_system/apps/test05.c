@@ -8,31 +8,51 @@
 
 int main() {
 
-    init();
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
 
     // This function is exactly the same as a normal data file creation,
-    // but it leaves the "working" flag up after finishing.
-    simulate_write_crash("/foo", (unsigned char*)"sassafrass", 11);
+    // but it crashes before the journal commits.
+    simulate_write_crash(fs, "/foo", (unsigned char*)"sassafrass", 11);
 
-    sys_recover();
+    sys_recover(fs);
 
     // trying to read "/foo" at this point causes an intended exit,
     // as the above write resulted in a potentially corrupt file.
 
     // Notice how this write uses the corrupted inode + data blocks
-    make_datafile("/bar", (unsigned char*)"bbbbbbbbbb", 11);
+    make_datafile(fs, "/bar", (unsigned char*)"bbbbbbbbbb", 11);
 
-    // Similarly, this function deletes a file, but does not lower
-    // the "working" flag after finishing.
-    simulate_delete_crash("/bar");
+    // Similarly, this function deletes a file, but crashes before the
+    // deletion commits.
+    simulate_delete_crash(fs, "/bar");
 
-    sys_recover();
+    sys_recover(fs);
 
     // The file still exists, and we can read from it as normal
-    unsigned char* buffer = read_file("/bar");
+    unsigned char* buffer = read_file(fs, "/bar");
     for (int i=0; i<11; i++) {
         printf("%c ", buffer[i]);
     } printf("\n\n");
-
+    free(buffer);
+
+    // Recovery restores inodes on disk, so the cached copies must agree.
+    // Remounting starts with an empty inode cache, so both reads of /bar
+    // have to match.
+    llfs_unmount(fs);
+    fs = llfs_mount("../disk/vdisk");
+    buffer = read_file(fs, "/bar");
+    printf("/bar after remounting: %s\n\n",
+            strcmp((char*)buffer, "bbbbbbbbbb") == 0 ? "OK" : "STALE");
+    free(buffer);
+
+    // The inode the crashed write left behind can be used again
+    make_datafile(fs, "/foo", (unsigned char*)"sassafrass", 11);
+    buffer = read_file(fs, "/foo");
+    printf("/foo written again: %s\n\n",
+            strcmp((char*)buffer, "sassafrass") == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    llfs_unmount(fs);
     return 1;
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// Runs the same workload on every disk driver; the output should match.
+// Then drives asynchronous I/O on the uring driver straight through the
+// disk layer: reads submitted while a write to the same blocks is still
+// in flight see the new data, and a second write to them lands after the
+// first.
+
+#define NBLOCKS 16
+#define BLOCK 512
+
+static int order[4];
+static int completions;
+
+void workload(int driver) {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    set_disk_driver(llfs_disk(fs), driver);
+
+    init(fs, 512, 4096);
+
+    make_dir(fs, "/usr");
+    make_dir(fs, "/usr/resources");
+
+    unsigned char* data = malloc(1500);
+    for (int i=0; i<1500; i++) {
+        data[i] = (unsigned char)i;
+    }
+    make_datafile(fs, "/usr/resources/foo", data, 1500);
+
+    unsigned char* buffer = read_file(fs, "/usr/resources/foo");
+    printf("Read back %s\n\n", memcmp(data, buffer, 1500) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    delete_file(fs, "/usr");
+    make_datafile(fs, "/bar", data, 100);
+
+    buffer = read_file(fs, "/bar");
+    printf("Read back %s\n\n", memcmp(data, buffer, 100) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+    free(data);
+
+    struct cache_stats stats;
+    get_cache_stats(llfs_disk(fs), &stats);
+    printf("Cache: %ld hits, %ld misses, %ld writebacks\n\n",
+            stats.hits, stats.misses, stats.writebacks);
+
+    llfs_unmount(fs);
+}
+
+static void done(void* arg) {
+
+    order[completions++] = *(int*)arg;
+}
+
+static int all_set(unsigned char* buffer, int from, int count, unsigned char value) {
+
+    for (int i=from*BLOCK; i<(from+count)*BLOCK; i++) {
+        if (buffer[i] != value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void async_io() {
+
+    struct disk* disk = open_disk("../disk/vdisk");
+    set_disk_driver(disk, DISK_DRIVER_URING);
+    wipe_disk(disk);
+
+    int ids[4] = { 0, 1, 2, 3 };
+    int blocks[NBLOCKS];
+    int halves[NBLOCKS / 2];
+    for (int i=0; i<NBLOCKS; i++) {
+        blocks[i] = 100 + i;
+    }
+    for (int i=0; i<NBLOCKS/2; i++) {
+        halves[i] = 100 + i * 2;
+    }
+
+    unsigned char* first = malloc(NBLOCKS * BLOCK);
+    unsigned char* second = malloc(NBLOCKS / 2 * BLOCK);
+    unsigned char* before = malloc(NBLOCKS * BLOCK);
+    unsigned char* after = malloc(NBLOCKS * BLOCK);
+    memset(first, 'a', NBLOCKS * BLOCK);
+    memset(second, 'b', NBLOCKS / 2 * BLOCK);
+
+    // Write every block, read them all back before the write can have
+    // finished, overwrite every other one, then read them all again
+    submit_write_blocks(disk, blocks, NBLOCKS, first, done, &ids[0]);
+    submit_read_blocks(disk, blocks, NBLOCKS, before, done, &ids[1]);
+    submit_write_blocks(disk, halves, NBLOCKS / 2, second, done, &ids[2]);
+    submit_read_blocks(disk, blocks, NBLOCKS, after, done, &ids[3]);
+
+    while (completions < 4) {
+        poll_io(disk);
+    }
+
+    int position[4];
+    for (int i=0; i<4; i++) {
+        position[order[i]] = i;
+    }
+    printf("Callbacks run: %d\n", completions);
+    printf("First write done before the second: %s\n", position[0] < position[2] ? "yes" : "no");
+
+    printf("First read saw the first write: %s\n",
+            all_set(before, 0, NBLOCKS, 'a') ? "OK" : "STALE");
+
+    int ok = 1;
+    for (int i=0; i<NBLOCKS; i++) {
+        ok &= all_set(after, i, 1, i % 2 == 0 ? 'b' : 'a');
+    }
+    printf("Second read saw both writes: %s\n", ok ? "OK" : "STALE");
+
+    // Once everything has completed, the image itself has the same blocks
+    read_block_range(disk, 100, NBLOCKS, after);
+    ok = 1;
+    for (int i=0; i<NBLOCKS; i++) {
+        ok &= all_set(after, i, 1, i % 2 == 0 ? 'b' : 'a');
+    }
+    printf("Image after completion: %s\n\n", ok ? "OK" : "CORRUPTED");
+
+    free(first);
+    free(second);
+    free(before);
+    free(after);
+    close_disk(disk);
+}
+
+int main() {
+
+    printf("=== pio driver ===\n\n");
+    workload(DISK_DRIVER_PIO);
+
+    printf("=== mmap driver ===\n\n");
+    workload(DISK_DRIVER_MMAP);
+
+    printf("=== uring driver ===\n\n");
+    workload(DISK_DRIVER_URING);
+
+    printf("=== ram driver ===\n\n");
+    workload(DISK_DRIVER_RAM);
+
+    printf("=== asynchronous I/O ===\n\n");
+    async_io();
+
+    return 1;
+}
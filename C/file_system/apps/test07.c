@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+
+// Runs a small workload and dumps the per-operation I/O counters and latencies
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    InitLLFS(fs);
+    reset_stats(fs);
+
+    make_dir(fs, "/usr");
+    make_dir(fs, "/usr/resources");
+
+    unsigned char* data = malloc(3000);
+    for (int i=0; i<3000; i++) {
+        data[i] = (unsigned char)i;
+    }
+    make_datafile(fs, "/usr/resources/foo", data, 3000);
+    make_datafile(fs, "/usr/bar", data, 100);
+
+    unsigned char* buffer = read_file(fs, "/usr/resources/foo");
+    free(buffer);
+    buffer = read_file(fs, "/usr/bar");
+    free(buffer);
+    free(data);
+
+    delete_file(fs, "/usr");
+
+    print_stats(fs, 0);
+    printf("\n");
+    print_stats(fs, 1);
+
+    llfs_unmount(fs);
+    return 1;
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../io/File.h"
+
+// Several file systems at once: each thread formats and fills its own disk
+// image through its own handle, then we reopen every image to check that
+// nothing leaked between them.
+
+#define NUM_SHARDS 4
+
+struct shard {
+    int id;
+    char path[64];
+    int ok;
+};
+
+void* fill_shard(void* arg) {
+
+    struct shard* shard = arg;
+
+    llfs_t* fs = llfs_mount(shard->path);
+    init(fs, 512 << (shard->id % 2), 4096);
+
+    make_dir(fs, "/data");
+
+    unsigned char data[1000];
+    memset(data, 'a' + shard->id, sizeof(data));
+    make_datafile(fs, "/data/shard", data, sizeof(data));
+
+    unsigned char* buffer = read_file(fs, "/data/shard");
+    shard->ok = memcmp(data, buffer, sizeof(data)) == 0;
+    free(buffer);
+
+    llfs_unmount(fs);
+    return NULL;
+}
+
+int main() {
+
+    struct shard shards[NUM_SHARDS];
+    pthread_t threads[NUM_SHARDS];
+
+    for (int i=0; i<NUM_SHARDS; i++) {
+        shards[i].id = i;
+        snprintf(shards[i].path, sizeof(shards[i].path), "../disk/shard%d", i);
+        pthread_create(&threads[i], NULL, fill_shard, &shards[i]);
+    }
+    for (int i=0; i<NUM_SHARDS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i=0; i<NUM_SHARDS; i++) {
+        llfs_t* fs = llfs_mount(shards[i].path);
+        unsigned char* buffer = read_file(fs, "/data/shard");
+
+        printf("Shard %d: written %s, holds '%c' * 1000 %s\n\n", i,
+                shards[i].ok ? "OK" : "CORRUPTED", buffer[0],
+                buffer[999] == buffer[0] ? "OK" : "CORRUPTED");
+
+        free(buffer);
+        llfs_unmount(fs);
+        remove(shards[i].path);
+    }
+
+    return 1;
+}
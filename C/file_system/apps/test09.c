@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// The RAM disk: a scratch file system that only touches the image file
+// when it's snapshotted, and that can be loaded back from one later
+
+int main() {
+
+    unsigned char* data = malloc(700);
+    for (int i=0; i<700; i++) {
+        data[i] = (unsigned char)(i * 7);
+    }
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    set_disk_driver(llfs_disk(fs), DISK_DRIVER_RAM);
+    init(fs, 512, 4096);
+
+    make_dir(fs, "/tmp");
+    make_datafile(fs, "/tmp/notes", data, 700);
+
+    // Without this, everything above is gone at unmount
+    llfs_snapshot(fs, "../disk/vdisk");
+    llfs_unmount(fs);
+
+    // The snapshot is an ordinary disk image
+    fs = llfs_mount("../disk/vdisk");
+    unsigned char* buffer = read_file(fs, "/tmp/notes");
+    printf("Snapshot holds the file: %s\n\n", memcmp(data, buffer, 700) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    make_datafile(fs, "/tmp/more", data, 100);
+    llfs_unmount(fs);
+
+    // ...and can be loaded into a new RAM disk to pick up where we left off
+    fs = llfs_mount("../disk/vdisk");
+    set_disk_driver(llfs_disk(fs), DISK_DRIVER_RAM);
+    llfs_load(fs, "../disk/vdisk");
+
+    buffer = read_file(fs, "/tmp/notes");
+    printf("Loaded notes: %s\n\n", memcmp(data, buffer, 700) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    buffer = read_file(fs, "/tmp/more");
+    printf("Loaded more: %s\n\n", memcmp(data, buffer, 100) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    llfs_unmount(fs);
+
+    // A snapshot taken at another block size loads into a disk that's
+    // still at this one
+    fs = llfs_mount("../disk/vdisk");
+    set_disk_driver(llfs_disk(fs), DISK_DRIVER_RAM);
+    init(fs, 1024, 2048);
+    make_datafile(fs, "/big", data, 700);
+    llfs_snapshot(fs, "../disk/vdisk");
+    llfs_unmount(fs);
+
+    fs = llfs_mount("../disk/vdisk");
+    set_disk_driver(llfs_disk(fs), DISK_DRIVER_RAM);
+    init(fs, 512, 4096);
+    llfs_load(fs, "../disk/vdisk");
+
+    buffer = read_file(fs, "/big");
+    printf("Loaded from 1024-byte blocks: %s\n\n", memcmp(data, buffer, 700) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    llfs_unmount(fs);
+    free(data);
+
+    return 1;
+}
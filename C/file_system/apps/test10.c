@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// Big files on a fragmented disk: the file has more extents than its
+// inode holds, so the rest go in indirect and double-indirect blocks
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init_fs(fs, 512, 512, 256);
+
+    // 14 directories of 15 one-block files each, then fill up the rest
+    unsigned char small[10] = "small";
+    char path[32];
+    for (int d=0; d<14; d++) {
+        sprintf(path, "/d%d", d);
+        make_dir(fs, path);
+
+        for (int f=0; f<15; f++) {
+            sprintf(path, "/d%d/f%d", d, f);
+            make_datafile(fs, path, small, 10);
+        }
+    }
+
+    unsigned char* filler = calloc(171, 512);
+    make_datafile(fs, "/filler", filler, 171 * 512);
+    free(filler);
+
+    // Every other file goes, leaving 112 one-block holes
+    for (int d=0; d<14; d++) {
+        for (int f=0; f<15; f+=2) {
+            sprintf(path, "/d%d/f%d", d, f);
+            delete_file(fs, path);
+        }
+    }
+
+    // 100 blocks in 100 extents: 6 in the inode, 64 in the indirect block
+    // and the last 30 under the double-indirect block
+    int size = 100 * 512;
+    unsigned char* data = malloc(size);
+    for (int i=0; i<size; i++) {
+        data[i] = (unsigned char)(i * 31 + i / 512);
+    }
+    make_datafile(fs, "/big", data, size);
+
+    unsigned char* buffer = read_file(fs, "/big");
+    printf("Big file reads back: %s\n\n", memcmp(data, buffer, size) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    // Deleting it has to free the map blocks too, or this won't fit again
+    delete_file(fs, "/big");
+    make_datafile(fs, "/big", data, size);
+
+    buffer = read_file(fs, "/big");
+    printf("Big file after remaking it: %s\n\n", memcmp(data, buffer, size) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    llfs_unmount(fs);
+    free(data);
+
+    return 1;
+}
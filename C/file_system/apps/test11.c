@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// Block groups: with 512-byte blocks, each group is 4096 blocks, so this
+// disk has 4. Group 0 holds the superblock, bitmaps and inodes; each
+// top-level directory gets a group of its own, and its files (and its
+// subdirectories' files) go in the same group as it.
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 16384);
+
+    unsigned char data[1500];
+    memset(data, 'x', sizeof(data));
+
+    const char* dirs[3] = { "/home", "/var", "/opt" };
+    char path[64];
+
+    // Interleave the work, which would interleave the blocks too if every
+    // file just took the lowest free block
+    for (int f=0; f<2; f++) {
+        for (int d=0; d<3; d++) {
+            if (f == 0) {
+                make_dir(fs, (char*)dirs[d]);
+            }
+            sprintf(path, "%s/file%d", dirs[d], f);
+            make_datafile(fs, path, data, sizeof(data));
+        }
+    }
+
+    make_dir(fs, "/home/docs");
+    make_datafile(fs, "/home/docs/letter", data, sizeof(data));
+
+    // Files in the root stay in group 0 with it
+    make_datafile(fs, "/motd", data, 20);
+
+    llfs_unmount(fs);
+    return 1;
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// Delayed allocation: small files made back to back only land on the disk
+// at the next flush, packed one after another into a single run of blocks
+// that's written in one go
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
+
+    make_dir(fs, "/logs");
+
+    // Leave a couple of one-block holes that a file would normally drop into
+    unsigned char hole[10] = "hole";
+    make_datafile(fs, "/logs/a", hole, 10);
+    make_datafile(fs, "/logs/b", hole, 10);
+    make_datafile(fs, "/logs/c", hole, 10);
+    delete_file(fs, "/logs/a");
+
+    llfs_set_delayed_alloc(fs, 1);
+
+    unsigned char data[8][700];
+    char path[32];
+    for (int i=0; i<8; i++) {
+        memset(data[i], 'a' + i, sizeof(data[i]));
+        sprintf(path, "/logs/day%d", i);
+        make_datafile(fs, path, data[i], 100 + i * 80);
+    }
+    printf("Nothing made yet; reading one flushes them all\n\n");
+
+    unsigned char* buffer = read_file(fs, "/logs/day5");
+    printf("day5 reads back: %s\n\n", memcmp(buffer, data[5], 500) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+
+    // Unmounting flushes too
+    make_datafile(fs, "/logs/late", data[0], 10);
+    llfs_unmount(fs);
+
+    fs = llfs_mount("../disk/vdisk");
+    buffer = read_file(fs, "/logs/late");
+    printf("late reads back: %s\n\n", memcmp(buffer, data[0], 10) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+    llfs_unmount(fs);
+
+    return 1;
+}
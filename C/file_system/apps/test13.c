@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// File handles: open a file once, then read, overwrite and extend it
+// by offset without going back through its path. Reads go straight into
+// the caller's buffers.
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
+
+    int size = 20 * 512 + 100;
+    unsigned char* data = malloc(size);
+    for (int i=0; i<size; i++) {
+        data[i] = (unsigned char)(i * 17 + i / 512);
+    }
+
+    make_dir(fs, "/db");
+    make_datafile(fs, "/db/table", data, size);
+
+    int fd = llfs_open(fs, "/db/table");
+    printf("Opened /db/table as %d\n\n", fd);
+
+    // A read in the middle, across a block boundary
+    unsigned char buffer[1000];
+    int n = llfs_pread(fs, fd, buffer, 300, 5000);
+    printf("pread 300 bytes at 5000: got %d, %s\n", n, memcmp(buffer, data + 5000, 300) == 0 ? "OK" : "CORRUPTED");
+
+    // Reads stop at the end of the file
+    n = llfs_pread(fs, fd, buffer, 1000, size - 40);
+    printf("pread 1000 bytes at %d: got %d, %s\n", size - 40, n, memcmp(buffer, data + size - 40, 40) == 0 ? "OK" : "CORRUPTED");
+
+    // Overwrite a few bytes in the middle of one block, and a span covering
+    // the end of one block, a whole block and the start of the next
+    memset(buffer, 'X', sizeof(buffer));
+    llfs_pwrite(fs, fd, buffer, 10, 2000);
+    memset(data + 2000, 'X', 10);
+    n = llfs_pwrite(fs, fd, buffer, 800, 3000);
+    memset(data + 3000, 'X', 800);
+    printf("pwrite 800 bytes at 3000: wrote %d\n", n);
+
+    // A write past the end grows the file
+    n = llfs_pwrite(fs, fd, buffer, 100, size - 10);
+    data = realloc(data, size + 90);
+    memset(data + size - 10, 'X', 100);
+    size += 90;
+    printf("pwrite 100 bytes at %d: wrote %d, size now %d\n\n", size - 100, n, llfs_seek(fs, fd, 0, SEEK_END));
+
+    // Stream the whole file back through the handle, 700 bytes at a time
+    unsigned char* copy = malloc(size);
+    llfs_seek(fs, fd, 0, SEEK_SET);
+    int total = 0;
+    while ((n = llfs_read(fs, fd, copy + total, 700)) > 0) {
+        total += n;
+    }
+    printf("Streamed %d bytes: %s\n\n", total, total == size && memcmp(copy, data, size) == 0 ? "OK" : "CORRUPTED");
+    free(copy);
+
+    // Scatter a read over three buffers: the odd sizes mean a block
+    // straddles each boundary between them
+    unsigned char part1[700], part2[1300], part3[2000];
+    struct iovec iov[3] = { { part1, 700 }, { part2, 1300 }, { part3, 2000 } };
+    n = llfs_preadv(fs, fd, iov, 3, 1000);
+    printf("preadv 4000 bytes at 1000: got %d, %s\n\n", n,
+            memcmp(part1, data + 1000, 700) == 0 && memcmp(part2, data + 1700, 1300) == 0
+            && memcmp(part3, data + 3000, 2000) == 0 ? "OK" : "CORRUPTED");
+
+    llfs_close(fs, fd);
+
+    // The changes are in the file for everyone else too, and it can be
+    // read straight into a buffer of our own
+    unsigned char* contents = malloc(size + 100);
+    n = read_file_into(fs, "/db/table", contents, size + 100);
+    printf("read_file_into after the writes: got %d, %s\n\n", n, memcmp(contents, data, size) == 0 ? "OK" : "CORRUPTED");
+    free(contents);
+
+    // Handles are reused lowest first
+    int a = llfs_open(fs, "/db/table");
+    int b = llfs_open(fs, "/db/table");
+    llfs_close(fs, a);
+    printf("Handles %d and %d, then %d again after closing %d\n", a, b, llfs_open(fs, "/db/table"), a);
+
+    llfs_unmount(fs);
+    free(data);
+
+    return 1;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// Changing a data file in place: overwrite part of it, append to it and
+// write past its end, without remaking it. Only the blocks a write covers
+// go to the disk, and a crash part way through an append or an overwrite
+// is undone.
+
+static unsigned char model[64 * 512];
+static int model_size;
+
+static void check(llfs_t* fs, char* path) {
+
+    unsigned char* buffer = read_file(fs, path);
+    printf("%s holds %d bytes: %s\n\n", path, model_size,
+            memcmp(buffer, model, model_size) == 0 ? "OK" : "CORRUPTED");
+    free(buffer);
+}
+
+static void append(llfs_t* fs, char* path, int count, unsigned char c) {
+
+    memset(model + model_size, c, count);
+    append_file(fs, path, model + model_size, count);
+    model_size += count;
+}
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init(fs, 512, 4096);
+
+    make_dir(fs, "/logs");
+
+    model_size = 700;
+    for (int i=0; i<model_size; i++) {
+        model[i] = (unsigned char)('a' + i % 26);
+    }
+    make_datafile(fs, "/logs/app", model, model_size);
+
+    // The blocks after the file are free, so its last extent just gets longer
+    append(fs, "/logs/app", 1000, '1');
+
+    // Now they aren't, and the next append has to go somewhere else
+    unsigned char other[10] = "other";
+    make_datafile(fs, "/logs/other", other, 10);
+    append(fs, "/logs/app", 600, '2');
+    check(fs, "/logs/app");
+
+    // Overwrite 50 bytes across a block boundary: only those two blocks are written
+    reset_stats(fs);
+    unsigned char patch[50];
+    memset(patch, 'P', sizeof(patch));
+    write_file(fs, "/logs/app", 1000, patch, sizeof(patch));
+    memcpy(model + 1000, patch, sizeof(patch));
+    print_stats(fs, 0);
+    printf("\n");
+
+    // Writing past the end leaves a gap of zeros
+    write_file(fs, "/logs/app", model_size + 300, patch, sizeof(patch));
+    memset(model + model_size, 0, 300);
+    memcpy(model + model_size + 300, patch, sizeof(patch));
+    model_size += 300 + sizeof(patch);
+    check(fs, "/logs/app");
+
+    // Fragment it past the inode's own extents, so it needs map blocks
+    char path[32];
+    for (int i=0; i<10; i++) {
+        sprintf(path, "/logs/spacer%d", i);
+        make_datafile(fs, path, other, 10);
+        append(fs, "/logs/app", 512, '3' + i % 5);
+    }
+    check(fs, "/logs/app");
+
+    // A crash while appending takes the file back to how it was before
+    unsigned char lost[1500];
+    memset(lost, '!', sizeof(lost));
+    simulate_append_crash(fs, "/logs/app", lost, sizeof(lost));
+    sys_recover(fs);
+    check(fs, "/logs/app");
+
+    // ...and the blocks the append took are free again
+    append(fs, "/logs/app", 1500, 'Z');
+    check(fs, "/logs/app");
+
+    // A crash while overwriting leaves every byte as it was, even in the
+    // blocks the write only covers part of
+    simulate_overwrite_crash(fs, "/logs/app", 700, lost, sizeof(lost));
+    sys_recover(fs);
+    check(fs, "/logs/app");
+
+    // Overwriting through a handle moves blocks the same way
+    int fd = llfs_open(fs, "/logs/app");
+    llfs_pwrite(fs, fd, lost, 100, 2000);
+    memcpy(model + 2000, lost, 100);
+    llfs_close(fs, fd);
+    check(fs, "/logs/app");
+
+    llfs_unmount(fs);
+
+    return 1;
+}
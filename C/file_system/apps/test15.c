@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// Transactions: a bulk load of files shares one journal commit instead
+// of paying for one on every file, a transaction that crashes before
+// it commits is undone as a whole, and one can't outgrow the journal
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init_fs(fs, 512, 8192, 512);
+
+    make_dir(fs, "/one");
+    make_dir(fs, "/batch");
+
+    unsigned char data[300];
+    char path[64];
+
+    // 40 files one at a time, then 40 in a transaction
+    reset_stats(fs);
+    for (int i=0; i<40; i++) {
+        memset(data, 'a' + i % 26, sizeof(data));
+        sprintf(path, "/one/f%d", i);
+        make_datafile(fs, path, data, sizeof(data));
+    }
+    print_stats(fs, 0);
+    printf("\n");
+
+    reset_stats(fs);
+    llfs_begin_transaction(fs);
+    for (int i=0; i<40; i++) {
+        memset(data, 'a' + i % 26, sizeof(data));
+        sprintf(path, "/batch/f%d", i);
+        make_datafile(fs, path, data, sizeof(data));
+    }
+    llfs_commit_transaction(fs);
+    print_stats(fs, 0);
+    printf("\n");
+
+    // Delete some files, make others and a directory, then crash
+    llfs_begin_transaction(fs);
+    for (int i=0; i<10; i++) {
+        sprintf(path, "/batch/f%d", i);
+        delete_file(fs, path);
+    }
+    make_dir(fs, "/batch/sub");
+    memset(data, '!', sizeof(data));
+    for (int i=0; i<10; i++) {
+        sprintf(path, "/batch/new%d", i);
+        make_datafile(fs, path, data, sizeof(data));
+    }
+    simulate_transaction_crash(fs);
+    sys_recover(fs);
+
+    // Everything deleted is back, with its data
+    int ok = 1;
+    for (int i=0; i<40; i++) {
+        sprintf(path, "/batch/f%d", i);
+        unsigned char* buffer = read_file(fs, path);
+        memset(data, 'a' + i % 26, sizeof(data));
+        ok &= memcmp(buffer, data, sizeof(data)) == 0;
+        free(buffer);
+    }
+    printf("After recovery, all 40 files read back: %s\n\n", ok ? "OK" : "CORRUPTED");
+
+    // ...and nothing that was made is, so the names are free again
+    make_dir(fs, "/batch/sub");
+    make_datafile(fs, "/batch/new0", data, sizeof(data));
+
+    llfs_unmount(fs);
+
+    // A transaction only holds as much as the journal does: fill one up
+    // until the next operation might not fit, and it still commits
+    fs = llfs_mount("../disk/vdisk");
+    init_fs(fs, 512, 8192, 2048);
+
+    llfs_begin_transaction(fs);
+    int made = 0;
+    while (made < 500 && llfs_transaction_has_room(fs)) {
+        sprintf(path, "/d%d", made);
+        make_dir(fs, path);
+        if (!llfs_transaction_has_room(fs)) {
+            break;
+        }
+        sprintf(path, "/d%d/f", made);
+        memset(data, 'a' + made % 26, sizeof(data));
+        make_datafile(fs, path, data, sizeof(data));
+        made++;
+    }
+    printf("Transaction full before 500 directories: %s\n\n", made < 500 ? "yes" : "no");
+    llfs_commit_transaction(fs);
+    llfs_unmount(fs);
+
+    fs = llfs_mount("../disk/vdisk");
+    ok = 1;
+    for (int i=0; i<made; i++) {
+        sprintf(path, "/d%d/f", i);
+        unsigned char* buffer = read_file(fs, path);
+        memset(data, 'a' + i % 26, sizeof(data));
+        ok &= memcmp(buffer, data, sizeof(data)) == 0;
+        free(buffer);
+    }
+    printf("Every file from the full transaction reads back: %s\n\n", ok ? "OK" : "CORRUPTED");
+
+    llfs_unmount(fs);
+
+    return 1;
+}
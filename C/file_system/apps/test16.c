@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// The journal: deleting a directory tree changes dozens of inode and
+// directory blocks, and after a crash either all of them have changed or
+// none of them have. Group commit logs several operations at once.
+
+static void make_tree(llfs_t* fs) {
+
+    unsigned char data[200];
+    char path[64];
+
+    make_dir(fs, "/tree");
+    for (int d=0; d<4; d++) {
+        sprintf(path, "/tree/d%d", d);
+        make_dir(fs, path);
+        for (int f=0; f<10; f++) {
+            sprintf(path, "/tree/d%d/f%d", d, f);
+            memset(data, 'a' + d * 10 + f % 26, sizeof(data));
+            make_datafile(fs, path, data, sizeof(data));
+        }
+    }
+}
+
+static void check_tree(llfs_t* fs) {
+
+    unsigned char data[200];
+    char path[64];
+    int ok = 1;
+
+    for (int d=0; d<4; d++) {
+        for (int f=0; f<10; f++) {
+            sprintf(path, "/tree/d%d/f%d", d, f);
+            memset(data, 'a' + d * 10 + f % 26, sizeof(data));
+            unsigned char* buffer = read_file(fs, path);
+            ok &= memcmp(buffer, data, sizeof(data)) == 0;
+            free(buffer);
+        }
+    }
+    printf("All 40 files in /tree read back: %s\n\n", ok ? "OK" : "CORRUPTED");
+}
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init_fs(fs, 512, 4096, 256);
+
+    make_tree(fs);
+
+    // A crash before the deletion commits leaves the whole tree
+    simulate_delete_crash(fs, "/tree");
+    sys_recover(fs);
+    check_tree(fs);
+
+    // A crash after it commits, before any block reaches its home: the
+    // replay finishes it, so every inode and block in the tree is free
+    // again, and making it over gets the same ones
+    simulate_committed_delete_crash(fs, "/tree");
+    sys_recover(fs);
+    make_tree(fs);
+    check_tree(fs);
+
+    // 40 files with a commit each, then 40 with a commit every 10: the
+    // directory, inode and bitmap blocks they share are logged once a group
+    unsigned char data[300];
+    char path[64];
+    make_dir(fs, "/one");
+    make_dir(fs, "/group");
+
+    reset_stats(fs);
+    for (int i=0; i<40; i++) {
+        memset(data, 'a' + i % 26, sizeof(data));
+        sprintf(path, "/one/f%d", i);
+        make_datafile(fs, path, data, sizeof(data));
+    }
+    print_stats(fs, 0);
+    printf("\n");
+
+    reset_stats(fs);
+    llfs_set_group_commit(fs, 10);
+    for (int i=0; i<40; i++) {
+        memset(data, 'a' + i % 26, sizeof(data));
+        sprintf(path, "/group/f%d", i);
+        make_datafile(fs, path, data, sizeof(data));
+    }
+    print_stats(fs, 0);
+    printf("\n");
+
+    llfs_unmount(fs);
+
+    return 1;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../io/File.h"
+#include "../disk/disk.h"
+
+// A directory with a file for every inode there is. The journal is sized
+// from the inode count, so the biggest operations (a bucket splitting
+// while the directory is full, deleting all of it at once) still fit.
+
+#define NUM_INODES 4000
+#define NUM_FILES (NUM_INODES - 2)	// the root and /full take one each
+
+int main() {
+
+    llfs_t* fs = llfs_mount("../disk/vdisk");
+    init_fs(fs, 512, 8192, NUM_INODES);
+
+    unsigned char data[40];
+    char path[64];
+
+    make_dir(fs, "/full");
+    for (int i=0; i<NUM_FILES; i++) {
+        sprintf(path, "/full/file%d", i);
+        memset(data, 'a' + i % 26, sizeof(data));
+        make_datafile(fs, path, data, sizeof(data));
+    }
+    llfs_unmount(fs);
+
+    // Mounting again means looking every name up from the disk
+    fs = llfs_mount("../disk/vdisk");
+    int ok = 1;
+    for (int i=0; i<NUM_FILES; i++) {
+        sprintf(path, "/full/file%d", i);
+        memset(data, 'a' + i % 26, sizeof(data));
+        unsigned char* buffer = read_file(fs, path);
+        ok &= memcmp(buffer, data, sizeof(data)) == 0;
+        free(buffer);
+    }
+    printf("All %d files in /full read back: %s\n\n", NUM_FILES, ok ? "OK" : "CORRUPTED");
+
+    // Every inode block changes at once here
+    delete_file(fs, "/full");
+
+    // ...and every inode is free again
+    make_dir(fs, "/full");
+    make_datafile(fs, "/full/again", data, sizeof(data));
+
+    llfs_unmount(fs);
+
+    return 1;
+}
@@ -1,57 +1,635 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 
-#define DISK_PATH "../disk/vdisk"
+#include "disk.h"
+#include "disk_driver.h"
 
-const int BLOCK_SIZE = 512;
-const int NUM_BLOCKS = 4096;
+// Blocks moved per step by snapshot_disk() and load_disk()
+#define COPY_CHUNK 64
 
+// Report a failed disk access and bail out, like every other disk error
+void disk_error(struct disk* disk, const char* action, int block_num) {
 
-// Read a specified block from a file into the given buffer.
-void read_block(int block_num, unsigned char* buffer) {
+	if (block_num < 0) {
+		printf("Unable to %s \"%s\"\n", action, disk->path);
+	} else {
+		printf("Unable to %s block %d of \"%s\"\n", action, block_num, disk->path);
+	}
+	exit(-1);
+}
 
-	FILE* diskfile = fopen(DISK_PATH, "rb");
-	if (diskfile == NULL) {
-		printf("Unable to open file: \"%s\"\n", DISK_PATH);
-		exit(-1);
+
+// Set up a handle for the disk image at path. Nothing is opened until the
+// first block access, so the image doesn't have to exist yet.
+struct disk* open_disk(const char* path) {
+
+	struct disk* disk = calloc(1, sizeof(struct disk));
+	disk->path = strdup(path);
+	disk->block_size = DEFAULT_BLOCK_SIZE;
+	disk->num_blocks = DEFAULT_NUM_BLOCKS;
+	disk->fd = -1;
+	disk->driver = &pio_driver;
+	disk->cache_size = DEFAULT_CACHE_SIZE;
+	return disk;
+}
+
+
+// Unmount the image (syncing it) and free the handle
+void close_disk(struct disk* disk) {
+
+	unmount_disk(disk);
+	if (disk->driver->release) {
+		disk->driver->release(disk);
+	}
+	free(disk->path);
+	free(disk);
+}
+
+
+// Pick the driver used for the next mount (one of the DISK_DRIVER_* values).
+// Leaving the ram driver throws its blocks away.
+void set_disk_driver(struct disk* disk, int driver) {
+
+	const struct disk_driver* next;
+	switch (driver) {
+		case DISK_DRIVER_MMAP:
+			next = &mmap_driver;
+			break;
+		case DISK_DRIVER_URING:
+			next = &uring_driver;
+			break;
+		case DISK_DRIVER_RAM:
+			next = &ram_driver;
+			break;
+		default:
+			next = &pio_driver;
+			break;
+	}
+
+	if (next == disk->driver) {
+		return;
+	}
+
+	unmount_disk(disk);
+	if (disk->driver->release) {
+		disk->driver->release(disk);
+	}
+	disk->driver = next;
+}
+
+
+// Whether the driver picked with set_disk_driver() couldn't start (io_uring
+// missing from the kernel) and the pio driver is doing its I/O instead.
+// Mounts the disk, since that's when it's decided.
+int disk_fell_back(struct disk* disk) {
+
+	mount_disk(disk);
+	return disk->fallback;
+}
+
+
+// Change the block size and block count used for the next mount
+void set_disk_geometry(struct disk* disk, int block_size, int num_blocks) {
+
+	if (block_size == disk->block_size && num_blocks == disk->num_blocks) {
+		return;
+	}
+
+	unmount_disk(disk);
+	disk->block_size = block_size;
+	disk->num_blocks = num_blocks;
+}
+
+
+// Set how many blocks the buffer cache holds; 0 turns it off.
+// Takes effect the next time the disk is mounted.
+void set_cache_size(struct disk* disk, int num_blocks) {
+
+	unmount_disk(disk);
+	disk->cache_size = num_blocks;
+}
+
+
+// Open the disk image once and keep the descriptor around for block I/O
+void mount_disk(struct disk* disk) {
+
+	if (disk->mounted) {
+		return;
+	}
+
+	if (!disk->driver->in_memory) {
+		disk->fd = open(disk->path, O_RDWR);
+		if (disk->fd < 0) {
+			disk_error(disk, "open", -1);
+		}
+	}
+
+	disk->driver->mount(disk);
+
+	if (disk->driver->cacheable && disk->cache_size > 0) {
+		disk->cache = cache_create(disk->cache_size, disk->block_size);
+	}
+	disk->mounted = 1;
+}
+
+
+// Close the disk image; the next block access will mount it again
+void unmount_disk(struct disk* disk) {
+
+	if (!disk->mounted) {
+		return;
+	}
+
+	sync_disk(disk);
+
+	if (disk->cache) {
+		cache_destroy(disk->cache);
+		disk->cache = NULL;
+	}
+	disk->driver->unmount(disk);
+
+	if (disk->fd >= 0) {
+		close(disk->fd);
+		disk->fd = -1;
+	}
+	disk->mounted = 0;
+}
+
+
+// The data of an asynchronous write to block_num that hasn't completed yet,
+// or NULL. Until it completes the driver may still hand back the block's old
+// contents, and another write to the block could land before it.
+static unsigned char* write_in_flight(struct disk* disk, int block_num) {
+
+	for (struct disk_request* req = disk->writing; req != NULL; req = req->next) {
+		int nblocks = req->iov.iov_len / disk->block_size;
+		if (block_num >= req->block_num && block_num < req->block_num + nblocks) {
+			return (unsigned char*)req->iov.iov_base +
+				(size_t)(block_num - req->block_num) * disk->block_size;
+		}
 	}
+	return NULL;
+}
+
+
+// Read a specified block from a file into the given buffer.
+void read_block(struct disk* disk, int block_num, unsigned char* buffer) {
+
+	mount_disk(disk);
 
-	fseek(diskfile, block_num * BLOCK_SIZE, SEEK_SET);
-	fread(buffer, BLOCK_SIZE, 1, diskfile);
+	if (write_in_flight(disk, block_num)) {
+		wait_io(disk);
+	}
 
-	fclose(diskfile);
+	if (disk->cache) {
+		cache_read(disk, block_num, buffer);
+	} else {
+		disk->driver->read(disk, block_num, buffer);
+	}
 }
 
 
 // Write the given data into a specified block of a file.
-void write_block(int block_num, unsigned char* data) {
+void write_block(struct disk* disk, int block_num, unsigned char* data) {
+
+	mount_disk(disk);
+
+	if (write_in_flight(disk, block_num)) {
+		wait_io(disk);
+	}
+
+	if (disk->cache) {
+		cache_write(disk, block_num, data);
+	} else {
+		disk->driver->write(disk, block_num, data);
+	}
+}
+
+
+// A group of requests submitted together; its callback runs once all finish
+struct io_batch {
+	struct disk* disk;
+	int pending;
+	io_callback done;
+	void* arg;
+};
+
+
+static void batch_release(struct io_batch* batch) {
+
+	if (--batch->pending == 0) {
+		if (batch->done) {
+			batch->done(batch->arg);
+		}
+		free(batch);
+	}
+}
+
+
+static void request_complete(struct disk_request* req) {
+
+	struct io_batch* batch = req->batch;
+
+	struct disk_request** link = &batch->disk->writing;
+	while (*link != NULL && *link != req) {
+		link = &(*link)->next;
+	}
+	if (*link != NULL) {
+		*link = req->next;
+	}
+
+	free(req);
+	batch_release(batch);
+}
+
+
+// Hand one run of adjacent blocks to the driver, asynchronously if it can
+static void submit_run(struct disk* disk, struct io_batch* batch, int write, int block_num,
+		unsigned char* buffer, int nblocks) {
+
+	struct disk_request* req = malloc(sizeof(struct disk_request));
+	req->write = write;
+	req->block_num = block_num;
+	req->iov.iov_base = buffer;
+	req->iov.iov_len = (size_t)nblocks * disk->block_size;
+	req->complete = request_complete;
+	req->batch = batch;
+	req->next = NULL;
+
+	batch->pending++;
+
+	if (disk->driver->submit) {
+		if (write) {
+			req->next = disk->writing;
+			disk->writing = req;
+		}
+		disk->driver->submit(disk, req);
+	} else if (write) {
+		disk->driver->writev(disk, block_num, &req->iov, 1);
+		request_complete(req);
+	} else {
+		disk->driver->readv(disk, block_num, &req->iov, 1);
+		request_complete(req);
+	}
+}
+
+
+static struct io_batch* batch_create(struct disk* disk, io_callback done, void* arg) {
+
+	struct io_batch* batch = malloc(sizeof(struct io_batch));
+	batch->disk = disk;
+	batch->pending = 1; // held until every run has been submitted
+	batch->done = done;
+	batch->arg = arg;
+	return batch;
+}
+
+
+// Start reading several blocks into one buffer, disk->block_size bytes per block,
+// in the order given. Each run of adjacent block numbers becomes a single
+// request. done(arg) is called once every block has arrived; with a
+// synchronous driver that happens before this returns. Blocks that an
+// earlier submit_write_blocks() is still writing are copied from its
+// buffer, so a read always sees the writes submitted before it.
+void submit_read_blocks(struct disk* disk, const int* block_nums, int count,
+		unsigned char* buffer, io_callback done, void* arg) {
+
+	mount_disk(disk);
+	struct io_batch* batch = batch_create(disk, done, arg);
+
+	int i = 0;
+	while (i < count) {
+		unsigned char* dest = buffer + (size_t)i * disk->block_size;
+
+		// The cache may hold a newer (dirty) copy than the disk does
+		if (disk->cache && cache_copy_out(disk->cache, block_nums[i], dest)) {
+			i++;
+			continue;
+		}
+
+		const unsigned char* pending = write_in_flight(disk, block_nums[i]);
+		if (pending) {
+			memcpy(dest, pending, disk->block_size);
+			i++;
+			continue;
+		}
+
+		int run = 1;
+		while (i + run < count && block_nums[i + run] == block_nums[i] + run) {
+			if (disk->cache && cache_holds(disk->cache, block_nums[i + run])) {
+				break;
+			}
+			if (write_in_flight(disk, block_nums[i + run])) {
+				break;
+			}
+			run++;
+		}
+
+		submit_run(disk, batch, 0, block_nums[i], dest, run);
+		i += run;
+	}
+
+	batch_release(batch);
+}
 
-	FILE* diskfile = fopen(DISK_PATH, "rb+");
-	if (diskfile == NULL) {
-		printf("Unable to open file: \"%s\"\n", DISK_PATH);
+
+// Start writing several blocks from one buffer, disk->block_size bytes per block.
+// The writes go straight to the driver rather than through the cache, and
+// the buffer has to stay untouched until done(arg) is called. If one of the
+// blocks is still being written by an earlier call, that write is waited for
+// first, so the two can't land out of order.
+void submit_write_blocks(struct disk* disk, const int* block_nums, int count,
+		unsigned char* data, io_callback done, void* arg) {
+
+	mount_disk(disk);
+
+	for (int i=0; i<count && disk->writing != NULL; i++) {
+		if (write_in_flight(disk, block_nums[i])) {
+			wait_io(disk);
+		}
+	}
+	struct io_batch* batch = batch_create(disk, done, arg);
+
+	int i = 0;
+	while (i < count) {
+		int run = 1;
+		while (i + run < count && block_nums[i + run] == block_nums[i] + run) {
+			run++;
+		}
+
+		unsigned char* src = data + (size_t)i * disk->block_size;
+		if (disk->cache) {
+			for (int j=0; j<run; j++) {
+				cache_overwrite(disk->cache, block_nums[i] + j, src + (size_t)j * disk->block_size);
+			}
+		}
+
+		submit_run(disk, batch, 1, block_nums[i], src, run);
+		i += run;
+	}
+
+	batch_release(batch);
+}
+
+
+// Complete whatever I/O has finished, without blocking.
+// Returns the number of requests that completed.
+int poll_io(struct disk* disk) {
+
+	if (!disk->mounted || disk->driver->reap == NULL) {
+		return 0;
+	}
+	return disk->driver->reap(disk, 0);
+}
+
+
+// Block until every submitted request has completed
+void wait_io(struct disk* disk) {
+
+	if (disk->mounted && disk->driver->reap != NULL) {
+		disk->driver->reap(disk, 1);
+	}
+}
+
+
+// Read several blocks into one buffer and wait for them. With the uring
+// driver, every run is in flight at the same time.
+void read_blocks(struct disk* disk, const int* block_nums, int count, unsigned char* buffer) {
+
+	submit_read_blocks(disk, block_nums, count, buffer, NULL, NULL);
+	wait_io(disk);
+}
+
+
+// Write several blocks from one buffer and wait for them
+void write_blocks(struct disk* disk, const int* block_nums, int count, unsigned char* data) {
+
+	submit_write_blocks(disk, block_nums, count, data, NULL, NULL);
+	wait_io(disk);
+}
+
+
+static int* block_list(int start, int count) {
+
+	int* block_nums = malloc(sizeof(int) * count);
+	for (int i=0; i<count; i++) {
+		block_nums[i] = start + i;
+	}
+	return block_nums;
+}
+
+
+// Read the blocks start .. start+count-1 into one buffer
+void read_block_range(struct disk* disk, int start, int count, unsigned char* buffer) {
+
+	int* block_nums = block_list(start, count);
+	read_blocks(disk, block_nums, count, buffer);
+	free(block_nums);
+}
+
+
+// Write the blocks start .. start+count-1 from one buffer
+void write_block_range(struct disk* disk, int start, int count, unsigned char* data) {
+
+	int* block_nums = block_list(start, count);
+	write_blocks(disk, block_nums, count, data);
+	free(block_nums);
+}
+
+
+// Get read-only access to a block without copying it, if the driver allows.
+// The pointer is only good until the next call into the disk layer.
+const unsigned char* peek_block(struct disk* disk, int block_num) {
+
+	mount_disk(disk);
+
+	if (write_in_flight(disk, block_num)) {
+		wait_io(disk);
+	}
+
+	if (disk->cache) {
+		return cache_peek(disk, block_num);
+	}
+	return disk->driver->peek(disk, block_num);
+}
+
+
+// Write every dirty cached block down to the driver, in block order
+void flush_cache(struct disk* disk) {
+
+	if (disk->cache) {
+		cache_flush(disk);
+	}
+}
+
+
+// Flush all writes made so far down to the disk image
+void sync_disk(struct disk* disk) {
+
+	if (disk->mounted) {
+		wait_io(disk);
+		flush_cache(disk);
+		disk->driver->sync(disk);
+	}
+}
+
+
+void get_cache_stats(struct disk* disk, struct cache_stats* stats) {
+
+	if (disk->cache) {
+		cache_get_stats(disk->cache, stats);
+	} else {
+		memset(stats, 0, sizeof(struct cache_stats));
+	}
+}
+
+
+// Create a new, zero-initialized disk. The disk is left mounted.
+// The image starts out as one big hole, so formatting costs nothing up
+// front; only the blocks that actually get written take up space.
+void wipe_disk(struct disk* disk) {
+
+	// Anything still cached belongs to the old file system
+	if (disk->cache) {
+		cache_invalidate(disk->cache);
+	}
+	unmount_disk(disk);
+
+	if (disk->driver->in_memory) {
+		disk->driver->release(disk);
+		mount_disk(disk);
+		return;
+	}
+
+	int fd = open(disk->path, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		disk_error(disk, "open", -1);
+	}
+
+	off_t disk_size = (off_t)disk->block_size * disk->num_blocks;
+	if (ftruncate(fd, disk_size) != 0) {
+		disk_error(disk, "format", -1);
+	}
+
+	close(fd);
+
+	mount_disk(disk);
+}
+
+
+static int block_is_zero(const unsigned char* block, int block_size) {
+
+	return block[0] == 0 && memcmp(block, block + 1, block_size - 1) == 0;
+}
+
+
+// Write the whole disk out to the image file at path, whatever the driver.
+// All-zero blocks are left as holes, so the snapshot is as sparse as the
+// disk it came from.
+void snapshot_disk(struct disk* disk, const char* path) {
+
+	sync_disk(disk);
+
+	// A file-backed disk's own image is already up to date
+	if (!disk->driver->in_memory && strcmp(path, disk->path) == 0) {
+		return;
+	}
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		printf("Unable to open \"%s\"\n", path);
+		exit(-1);
+	}
+
+	int block_size = disk->block_size;
+	if (ftruncate(fd, (off_t)block_size * disk->num_blocks) != 0) {
+		printf("Unable to write \"%s\"\n", path);
 		exit(-1);
 	}
 
-	fseek(diskfile, block_num * BLOCK_SIZE, SEEK_SET);
-	fwrite(data, BLOCK_SIZE, 1, diskfile);
+	unsigned char* chunk = malloc((size_t)COPY_CHUNK * block_size);
+
+	for (int start=0; start<disk->num_blocks; start+=COPY_CHUNK) {
+		int count = disk->num_blocks - start < COPY_CHUNK ? disk->num_blocks - start : COPY_CHUNK;
+		read_block_range(disk, start, count, chunk);
+
+		for (int i=0; i<count; i++) {
+			unsigned char* block = chunk + (size_t)i * block_size;
+			off_t offset = (off_t)(start + i) * block_size;
 
-	fclose(diskfile);
+			if (!block_is_zero(block, block_size) &&
+					pwrite(fd, block, block_size, offset) != block_size) {
+				printf("Unable to write \"%s\"\n", path);
+				exit(-1);
+			}
+		}
+	}
+
+	if (fsync(fd) != 0) {
+		printf("Unable to write \"%s\"\n", path);
+		exit(-1);
+	}
+
+	free(chunk);
+	close(fd);
 }
 
 
-// Create a new, zero-initialized disk.
-void wipe_disk() {
+// Replace the disk's contents with the image file at path. The block size
+// stays as it is, so the image has to be a whole number of blocks of it,
+// and the block count comes from the file's size; the file system sets
+// the real geometry from its superblock afterwards.
+void load_disk(struct disk* disk, const char* path) {
+
+	if (!disk->driver->in_memory && strcmp(path, disk->path) == 0) {
+		return;
+	}
 
-	FILE* diskfile = fopen(DISK_PATH, "wb+");
-	if (diskfile == NULL) {
-		printf("Unable to open file: \"%s\"\n", DISK_PATH);
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		printf("Unable to open \"%s\"\n", path);
 		exit(-1);
 	}
 
-	char* zeros = calloc(BLOCK_SIZE * NUM_BLOCKS, 1);
-	fwrite(zeros, BLOCK_SIZE * NUM_BLOCKS, 1, diskfile);
+	// A partial block at the end means the image was saved at some other
+	// block size, or isn't an image at all
+	int block_size = disk->block_size;
+	if (st.st_size == 0 || st.st_size % block_size != 0) {
+		close(fd);
+		disk_error(disk, "load a whole number of blocks into", -1);
+	}
+
+	set_disk_geometry(disk, block_size, st.st_size / block_size);
+	wipe_disk(disk);
+
+	unsigned char* chunk = malloc((size_t)COPY_CHUNK * block_size);
 
-	free(zeros);
-	fclose(diskfile);
-}
\ No newline at end of file
+	for (int start=0; start<disk->num_blocks; start+=COPY_CHUNK) {
+		int count = disk->num_blocks - start < COPY_CHUNK ? disk->num_blocks - start : COPY_CHUNK;
+		size_t len = (size_t)count * block_size;
+
+		if (pread(fd, chunk, len, (off_t)start * block_size) != (ssize_t)len) {
+			printf("Unable to read \"%s\"\n", path);
+			exit(-1);
+		}
+
+		// The wiped disk is already zeros; only copy what isn't
+		for (int i=0; i<count; i++) {
+			unsigned char* block = chunk + (size_t)i * block_size;
+			if (!block_is_zero(block, block_size)) {
+				write_block(disk, start + i, block);
+			}
+		}
+	}
+
+	free(chunk);
+	close(fd);
+
+	sync_disk(disk);
+}
@@ -1,8 +1,78 @@
-const int BLOCK_SIZE;
-const int NUM_BLOCKS;
+// A disk image; every call below works on the one it's given
+struct disk;
 
-void read_block(int block_num, unsigned char* buffer);
+#define MIN_BLOCK_SIZE 512
+#define DEFAULT_BLOCK_SIZE 512
+#define DEFAULT_NUM_BLOCKS 4096
 
-void write_block(int block_num, unsigned char* data);
+struct disk* open_disk(const char* path);
 
-void wipe_disk();
\ No newline at end of file
+void close_disk(struct disk* disk);
+
+void set_disk_geometry(struct disk* disk, int block_size, int num_blocks);
+
+// Disk drivers that can be passed to set_disk_driver()
+#define DISK_DRIVER_PIO  0
+#define DISK_DRIVER_MMAP 1
+#define DISK_DRIVER_URING 2
+#define DISK_DRIVER_RAM  3
+
+void set_disk_driver(struct disk* disk, int driver);
+
+// Whether the driver couldn't start on this mount and pio is standing in
+int disk_fell_back(struct disk* disk);
+
+// Buffer cache counters, since the disk was last mounted
+struct cache_stats {
+	long hits;
+	long misses;
+	long writebacks;	// dirty blocks written to the driver
+	long evictions;
+};
+
+#define DEFAULT_CACHE_SIZE 64
+
+void set_cache_size(struct disk* disk, int num_blocks);
+
+void flush_cache(struct disk* disk);
+
+void get_cache_stats(struct disk* disk, struct cache_stats* stats);
+
+void mount_disk(struct disk* disk);
+
+void unmount_disk(struct disk* disk);
+
+void read_block(struct disk* disk, int block_num, unsigned char* buffer);
+
+void write_block(struct disk* disk, int block_num, unsigned char* data);
+
+void read_blocks(struct disk* disk, const int* block_nums, int count, unsigned char* buffer);
+
+void write_blocks(struct disk* disk, const int* block_nums, int count, unsigned char* data);
+
+void read_block_range(struct disk* disk, int start, int count, unsigned char* buffer);
+
+void write_block_range(struct disk* disk, int start, int count, unsigned char* data);
+
+// Asynchronous multi-block I/O; see disk.c for when callbacks run
+typedef void (*io_callback)(void* arg);
+
+void submit_read_blocks(struct disk* disk, const int* block_nums, int count,
+		unsigned char* buffer, io_callback done, void* arg);
+
+void submit_write_blocks(struct disk* disk, const int* block_nums, int count,
+		unsigned char* data, io_callback done, void* arg);
+
+int poll_io(struct disk* disk);
+
+void wait_io(struct disk* disk);
+
+const unsigned char* peek_block(struct disk* disk, int block_num);
+
+void sync_disk(struct disk* disk);
+
+void wipe_disk(struct disk* disk);
+
+void snapshot_disk(struct disk* disk, const char* path);
+
+void load_disk(struct disk* disk, const char* path);
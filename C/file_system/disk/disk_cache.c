@@ -0,0 +1,282 @@
+/**
+ * disk_cache.c - Write-back LRU buffer cache in front of the disk driver.
+ *
+ * Each slot holds one block. Slots are found through a small hash table
+ * and kept on a doubly-linked list in least-recently-used order. Writes
+ * only dirty the cached copy; dirty blocks reach the driver when they're
+ * evicted or when the cache is flushed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "disk.h"
+#include "disk_driver.h"
+
+struct cache_slot {
+	int block_num;		// -1 if the slot is empty
+	int dirty;
+	unsigned char* data;
+
+	struct cache_slot* prev;	// LRU list, most recent at the head
+	struct cache_slot* next;
+	struct cache_slot* hnext;	// hash chain
+};
+
+struct block_cache {
+	int num_slots;
+	int block_size;
+	struct cache_slot* slots;
+	unsigned char* memory;
+
+	struct cache_slot** buckets;
+	int num_buckets;	// a power of 2
+
+	struct cache_slot* head;
+	struct cache_slot* tail;
+
+	struct cache_stats stats;
+};
+
+
+static int bucket_of(struct block_cache* cache, int block_num) {
+
+	return (unsigned int)block_num * 2654435761u & (cache->num_buckets - 1);
+}
+
+
+static void lru_unlink(struct block_cache* cache, struct cache_slot* slot) {
+
+	if (slot->prev) slot->prev->next = slot->next;
+	else cache->head = slot->next;
+
+	if (slot->next) slot->next->prev = slot->prev;
+	else cache->tail = slot->prev;
+}
+
+
+static void lru_push_front(struct block_cache* cache, struct cache_slot* slot) {
+
+	slot->prev = NULL;
+	slot->next = cache->head;
+
+	if (cache->head) cache->head->prev = slot;
+	else cache->tail = slot;
+
+	cache->head = slot;
+}
+
+
+static void hash_remove(struct block_cache* cache, struct cache_slot* slot) {
+
+	struct cache_slot** link = &cache->buckets[bucket_of(cache, slot->block_num)];
+	while (*link != slot) {
+		link = &(*link)->hnext;
+	}
+	*link = slot->hnext;
+}
+
+
+static struct cache_slot* lookup(struct block_cache* cache, int block_num) {
+
+	struct cache_slot* slot = cache->buckets[bucket_of(cache, block_num)];
+	while (slot != NULL && slot->block_num != block_num) {
+		slot = slot->hnext;
+	}
+	return slot;
+}
+
+
+// Hand out the least recently used slot for block_num, writing back its old block
+static struct cache_slot* claim_slot(struct disk* disk, int block_num) {
+
+	struct block_cache* cache = disk->cache;
+	struct cache_slot* slot = cache->tail;
+
+	if (slot->block_num >= 0) {
+		if (slot->dirty) {
+			disk->driver->write(disk, slot->block_num, slot->data);
+			cache->stats.writebacks++;
+		}
+		hash_remove(cache, slot);
+		cache->stats.evictions++;
+	}
+
+	slot->block_num = block_num;
+	slot->dirty = 0;
+
+	int b = bucket_of(cache, block_num);
+	slot->hnext = cache->buckets[b];
+	cache->buckets[b] = slot;
+
+	return slot;
+}
+
+
+// Find the block in the cache, reading it in on a miss; it becomes most recent
+static struct cache_slot* get_slot(struct disk* disk, int block_num) {
+
+	struct block_cache* cache = disk->cache;
+	struct cache_slot* slot = lookup(cache, block_num);
+
+	if (slot != NULL) {
+		cache->stats.hits++;
+	} else {
+		cache->stats.misses++;
+		slot = claim_slot(disk, block_num);
+		disk->driver->read(disk, block_num, slot->data);
+	}
+
+	lru_unlink(cache, slot);
+	lru_push_front(cache, slot);
+	return slot;
+}
+
+
+struct block_cache* cache_create(int num_slots, int block_size) {
+
+	struct block_cache* cache = calloc(1, sizeof(struct block_cache));
+	cache->num_slots = num_slots;
+	cache->block_size = block_size;
+	cache->slots = calloc(num_slots, sizeof(struct cache_slot));
+	cache->memory = malloc((size_t)num_slots * cache->block_size);
+
+	cache->num_buckets = 1;
+	while (cache->num_buckets < num_slots * 2) {
+		cache->num_buckets *= 2;
+	}
+	cache->buckets = calloc(cache->num_buckets, sizeof(struct cache_slot*));
+
+	for (int i=0; i<num_slots; i++) {
+		struct cache_slot* slot = &cache->slots[i];
+		slot->block_num = -1;
+		slot->data = cache->memory + (size_t)i * cache->block_size;
+		lru_push_front(cache, slot);
+	}
+
+	return cache;
+}
+
+
+void cache_destroy(struct block_cache* cache) {
+
+	free(cache->buckets);
+	free(cache->memory);
+	free(cache->slots);
+	free(cache);
+}
+
+
+void cache_read(struct disk* disk, int block_num, unsigned char* buffer) {
+
+	struct cache_slot* slot = get_slot(disk, block_num);
+	memcpy(buffer, slot->data, disk->block_size);
+}
+
+
+// Whole-block writes never need the old contents, so a miss doesn't read
+void cache_write(struct disk* disk, int block_num, const unsigned char* data) {
+
+	struct block_cache* cache = disk->cache;
+	struct cache_slot* slot = lookup(cache, block_num);
+
+	if (slot == NULL) {
+		slot = claim_slot(disk, block_num);
+	}
+
+	memcpy(slot->data, data, cache->block_size);
+	slot->dirty = 1;
+
+	lru_unlink(cache, slot);
+	lru_push_front(cache, slot);
+}
+
+
+const unsigned char* cache_peek(struct disk* disk, int block_num) {
+
+	return get_slot(disk, block_num)->data;
+}
+
+
+// Copy a block out if it's cached, without touching the LRU order.
+// Used by bulk reads, which shouldn't flood the cache with file data.
+int cache_copy_out(struct block_cache* cache, int block_num, unsigned char* buffer) {
+
+	struct cache_slot* slot = lookup(cache, block_num);
+	if (slot == NULL) {
+		return 0;
+	}
+
+	memcpy(buffer, slot->data, cache->block_size);
+	cache->stats.hits++;
+	return 1;
+}
+
+
+int cache_holds(struct block_cache* cache, int block_num) {
+
+	return lookup(cache, block_num) != NULL;
+}
+
+
+// A bulk write went straight to the driver; bring any cached copy up to date.
+// The copy is clean now, since the disk has the same bytes.
+void cache_overwrite(struct block_cache* cache, int block_num, const unsigned char* data) {
+
+	struct cache_slot* slot = lookup(cache, block_num);
+	if (slot != NULL) {
+		memcpy(slot->data, data, cache->block_size);
+		slot->dirty = 0;
+	}
+}
+
+
+static int compare_slots(const void* a, const void* b) {
+
+	const struct cache_slot* x = *(const struct cache_slot**)a;
+	const struct cache_slot* y = *(const struct cache_slot**)b;
+	return (x->block_num > y->block_num) - (x->block_num < y->block_num);
+}
+
+
+// Write every dirty block back to the driver, in block order
+void cache_flush(struct disk* disk) {
+
+	struct block_cache* cache = disk->cache;
+
+	struct cache_slot** dirty = malloc(sizeof(struct cache_slot*) * cache->num_slots);
+	int ndirty = 0;
+	for (int i=0; i<cache->num_slots; i++) {
+		if (cache->slots[i].dirty) {
+			dirty[ndirty++] = &cache->slots[i];
+		}
+	}
+
+	qsort(dirty, ndirty, sizeof(struct cache_slot*), compare_slots);
+
+	for (int i=0; i<ndirty; i++) {
+		disk->driver->write(disk, dirty[i]->block_num, dirty[i]->data);
+		dirty[i]->dirty = 0;
+		cache->stats.writebacks++;
+	}
+
+	free(dirty);
+}
+
+
+// Forget every cached block without writing anything back
+void cache_invalidate(struct block_cache* cache) {
+
+	memset(cache->buckets, 0, sizeof(struct cache_slot*) * cache->num_buckets);
+	for (int i=0; i<cache->num_slots; i++) {
+		cache->slots[i].block_num = -1;
+		cache->slots[i].dirty = 0;
+		cache->slots[i].hnext = NULL;
+	}
+}
+
+
+void cache_get_stats(struct block_cache* cache, struct cache_stats* stats) {
+
+	*stats = cache->stats;
+}
@@ -0,0 +1,104 @@
+/**
+ * disk_driver.h - The interface every disk backend implements.
+ *
+ * disk.c owns each disk's state and forwards its block requests to
+ * whichever driver was selected for it with set_disk_driver().
+ */
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+struct disk_driver;
+struct block_cache;
+struct uring;
+
+// One run of adjacent blocks handed to a driver's asynchronous interface.
+// complete() is called exactly once, when the transfer has finished.
+struct disk_request {
+	int write;
+	int block_num;
+	struct iovec iov;
+
+	void (*complete)(struct disk_request* req);
+	void* batch;	// owned by disk.c
+	struct disk_request* next;	// owned by disk.c
+};
+
+// State for one disk image, shared between disk.c and the drivers
+struct disk {
+	char* path;
+	int block_size;
+	int num_blocks;
+
+	int mounted;
+	int fd;			// -1 unless the driver has the image file open
+	const struct disk_driver* driver;
+
+	unsigned char* map;		// mmap driver: the whole image, mapped
+	size_t map_len;
+
+	unsigned char* scratch;	// pio/uring drivers: backing memory for peek_block()
+
+	struct uring* ring;		// uring driver: the submission/completion rings
+	int fallback;			// uring driver: no rings this mount, pio does the I/O
+
+	unsigned char* ram;		// ram driver: every block, kept across unmounts
+	size_t ram_len;
+
+	struct block_cache* cache;	// NULL when caching is off
+	int cache_size;				// in blocks, applied at mount time
+
+	struct disk_request* writing;	// asynchronous writes not yet complete
+};
+
+struct disk_driver {
+	const char* name;
+	int cacheable;		// whether the buffer cache should sit in front of it
+	int in_memory;		// never opens the image file; wiping is up to release()
+
+	void (*mount)(struct disk* disk);
+	void (*unmount)(struct disk* disk);
+
+	// Drop any blocks the driver keeps across unmounts, NULL if it keeps none
+	void (*release)(struct disk* disk);
+
+	void (*read)(struct disk* disk, int block_num, unsigned char* buffer);
+	void (*write)(struct disk* disk, int block_num, unsigned char* data);
+
+	// Transfer a run of adjacent blocks starting at block_num, scattered
+	// across (or gathered from) the iovecs, in a single request
+	void (*readv)(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt);
+	void (*writev)(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt);
+
+	// Asynchronous interface, NULL for drivers that only do synchronous I/O.
+	// submit() queues a request; reap() pushes queued requests to the kernel
+	// and completes finished ones, blocking until all are done if wait is set.
+	void (*submit)(struct disk* disk, struct disk_request* req);
+	int (*reap)(struct disk* disk, int wait);
+
+	// Return a pointer to the block's bytes, valid until the next disk call
+	const unsigned char* (*peek)(struct disk* disk, int block_num);
+
+	// Make every write so far durable on the image
+	void (*sync)(struct disk* disk);
+};
+
+extern const struct disk_driver pio_driver;
+extern const struct disk_driver mmap_driver;
+extern const struct disk_driver uring_driver;
+extern const struct disk_driver ram_driver;
+
+void disk_error(struct disk* disk, const char* action, int block_num);
+
+// The write-back buffer cache (disk_cache.c)
+struct block_cache* cache_create(int num_slots, int block_size);
+void cache_destroy(struct block_cache* cache);
+void cache_read(struct disk* disk, int block_num, unsigned char* buffer);
+void cache_write(struct disk* disk, int block_num, const unsigned char* data);
+const unsigned char* cache_peek(struct disk* disk, int block_num);
+int cache_copy_out(struct block_cache* cache, int block_num, unsigned char* buffer);
+int cache_holds(struct block_cache* cache, int block_num);
+void cache_overwrite(struct block_cache* cache, int block_num, const unsigned char* data);
+void cache_flush(struct disk* disk);
+void cache_invalidate(struct block_cache* cache);
+void cache_get_stats(struct block_cache* cache, struct cache_stats* stats);
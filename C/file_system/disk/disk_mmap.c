@@ -0,0 +1,101 @@
+/**
+ * disk_mmap.c - Disk driver that maps the whole image into memory.
+ *
+ * Reads and writes are plain memcpy()s against the mapping, and
+ * peek_block() hands out pointers straight into it. Dirty pages are
+ * pushed to the image with msync() whenever the disk is synced.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "disk.h"
+#include "disk_driver.h"
+
+
+static void mmap_mount(struct disk* disk) {
+
+	size_t len = (size_t)disk->block_size * disk->num_blocks;
+
+	struct stat st;
+	if (fstat(disk->fd, &st) != 0 || (size_t)st.st_size < len) {
+		disk_error(disk, "map", -1);
+	}
+
+	void* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, 0);
+	if (map == MAP_FAILED) {
+		disk_error(disk, "map", -1);
+	}
+
+	disk->map = map;
+	disk->map_len = len;
+}
+
+
+static void mmap_unmount(struct disk* disk) {
+
+	munmap(disk->map, disk->map_len);
+	disk->map = NULL;
+	disk->map_len = 0;
+}
+
+
+static void mmap_read(struct disk* disk, int block_num, unsigned char* buffer) {
+
+	memcpy(buffer, disk->map + (size_t)block_num * disk->block_size, disk->block_size);
+}
+
+
+static void mmap_write(struct disk* disk, int block_num, unsigned char* data) {
+
+	memcpy(disk->map + (size_t)block_num * disk->block_size, data, disk->block_size);
+}
+
+
+static void mmap_readv(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	unsigned char* src = disk->map + (size_t)block_num * disk->block_size;
+	for (int i=0; i<iovcnt; i++) {
+		memcpy(iov[i].iov_base, src, iov[i].iov_len);
+		src += iov[i].iov_len;
+	}
+}
+
+
+static void mmap_writev(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	unsigned char* dest = disk->map + (size_t)block_num * disk->block_size;
+	for (int i=0; i<iovcnt; i++) {
+		memcpy(dest, iov[i].iov_base, iov[i].iov_len);
+		dest += iov[i].iov_len;
+	}
+}
+
+
+static const unsigned char* mmap_peek(struct disk* disk, int block_num) {
+
+	return disk->map + (size_t)block_num * disk->block_size;
+}
+
+
+static void mmap_sync(struct disk* disk) {
+
+	if (msync(disk->map, disk->map_len, MS_SYNC) != 0) {
+		disk_error(disk, "sync", -1);
+	}
+}
+
+
+const struct disk_driver mmap_driver = {
+	.name = "mmap",
+	.cacheable = 0,
+	.mount = mmap_mount,
+	.unmount = mmap_unmount,
+	.read = mmap_read,
+	.write = mmap_write,
+	.readv = mmap_readv,
+	.writev = mmap_writev,
+	.peek = mmap_peek,
+	.sync = mmap_sync,
+};
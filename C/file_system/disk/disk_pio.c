@@ -0,0 +1,100 @@
+/**
+ * disk_pio.c - Disk driver using positional reads/writes on the open image.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "disk.h"
+#include "disk_driver.h"
+
+
+static void pio_mount(struct disk* disk) {
+
+	disk->scratch = malloc(disk->block_size);
+}
+
+
+static void pio_unmount(struct disk* disk) {
+
+	free(disk->scratch);
+	disk->scratch = NULL;
+}
+
+
+static void pio_read(struct disk* disk, int block_num, unsigned char* buffer) {
+
+	off_t offset = (off_t)block_num * disk->block_size;
+	if (pread(disk->fd, buffer, disk->block_size, offset) != disk->block_size) {
+		disk_error(disk, "read", block_num);
+	}
+}
+
+
+static void pio_write(struct disk* disk, int block_num, unsigned char* data) {
+
+	off_t offset = (off_t)block_num * disk->block_size;
+	if (pwrite(disk->fd, data, disk->block_size, offset) != disk->block_size) {
+		disk_error(disk, "write", block_num);
+	}
+}
+
+
+static size_t iov_total(const struct iovec* iov, int iovcnt) {
+
+	size_t total = 0;
+	for (int i=0; i<iovcnt; i++) {
+		total += iov[i].iov_len;
+	}
+	return total;
+}
+
+
+static void pio_readv(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	off_t offset = (off_t)block_num * disk->block_size;
+	if (preadv(disk->fd, iov, iovcnt, offset) != (ssize_t)iov_total(iov, iovcnt)) {
+		disk_error(disk, "read", block_num);
+	}
+}
+
+
+static void pio_writev(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	off_t offset = (off_t)block_num * disk->block_size;
+	if (pwritev(disk->fd, iov, iovcnt, offset) != (ssize_t)iov_total(iov, iovcnt)) {
+		disk_error(disk, "write", block_num);
+	}
+}
+
+
+// No mapping to point into, so the block is read into a per-disk scratch buffer
+static const unsigned char* pio_peek(struct disk* disk, int block_num) {
+
+	pio_read(disk, block_num, disk->scratch);
+	return disk->scratch;
+}
+
+
+// pwrite() only hands the data to the kernel; make it reach the device
+static void pio_sync(struct disk* disk) {
+
+	if (fdatasync(disk->fd) != 0) {
+		disk_error(disk, "sync", -1);
+	}
+}
+
+
+const struct disk_driver pio_driver = {
+	.name = "pio",
+	.cacheable = 1,
+	.mount = pio_mount,
+	.unmount = pio_unmount,
+	.read = pio_read,
+	.write = pio_write,
+	.readv = pio_readv,
+	.writev = pio_writev,
+	.peek = pio_peek,
+	.sync = pio_sync,
+};
@@ -0,0 +1,122 @@
+/**
+ * disk_ram.c - Disk driver that keeps every block in memory.
+ *
+ * The blocks live in an anonymous mapping (with transparent huge pages
+ * where the kernel has them) that outlives mount/unmount and is only
+ * dropped by wipe_disk(), close_disk() or switching drivers. The image
+ * file is never opened; use snapshot_disk() and load_disk() to move a
+ * RAM disk to and from one.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "disk.h"
+#include "disk_driver.h"
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+
+// Make sure the memory covers the disk's current geometry. Growing keeps
+// what's there (mount_fs() looks at block 0 before it knows the real
+// size), and the new part reads as zeros like a fresh sparse image.
+static void ram_mount(struct disk* disk) {
+
+	size_t len = (size_t)disk->block_size * disk->num_blocks;
+	len = (len + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+
+	if (len <= disk->ram_len) {
+		return;
+	}
+
+	void* ram;
+	if (disk->ram == NULL) {
+		ram = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	} else {
+		ram = mremap(disk->ram, disk->ram_len, len, MREMAP_MAYMOVE);
+	}
+	if (ram == MAP_FAILED) {
+		disk_error(disk, "allocate memory for", -1);
+	}
+
+	madvise(ram, len, MADV_HUGEPAGE);
+
+	disk->ram = ram;
+	disk->ram_len = len;
+}
+
+
+// The blocks stay put until the disk is wiped or closed
+static void ram_unmount(struct disk* disk) {
+}
+
+
+static void ram_release(struct disk* disk) {
+
+	if (disk->ram) {
+		munmap(disk->ram, disk->ram_len);
+		disk->ram = NULL;
+		disk->ram_len = 0;
+	}
+}
+
+
+static void ram_read(struct disk* disk, int block_num, unsigned char* buffer) {
+
+	memcpy(buffer, disk->ram + (size_t)block_num * disk->block_size, disk->block_size);
+}
+
+
+static void ram_write(struct disk* disk, int block_num, unsigned char* data) {
+
+	memcpy(disk->ram + (size_t)block_num * disk->block_size, data, disk->block_size);
+}
+
+
+static void ram_readv(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	unsigned char* src = disk->ram + (size_t)block_num * disk->block_size;
+	for (int i=0; i<iovcnt; i++) {
+		memcpy(iov[i].iov_base, src, iov[i].iov_len);
+		src += iov[i].iov_len;
+	}
+}
+
+
+static void ram_writev(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	unsigned char* dest = disk->ram + (size_t)block_num * disk->block_size;
+	for (int i=0; i<iovcnt; i++) {
+		memcpy(dest, iov[i].iov_base, iov[i].iov_len);
+		dest += iov[i].iov_len;
+	}
+}
+
+
+static const unsigned char* ram_peek(struct disk* disk, int block_num) {
+
+	return disk->ram + (size_t)block_num * disk->block_size;
+}
+
+
+// Nothing to make durable; snapshot_disk() is the way to keep a RAM disk
+static void ram_sync(struct disk* disk) {
+}
+
+
+const struct disk_driver ram_driver = {
+	.name = "ram",
+	.cacheable = 0,
+	.in_memory = 1,
+	.mount = ram_mount,
+	.unmount = ram_unmount,
+	.release = ram_release,
+	.read = ram_read,
+	.write = ram_write,
+	.readv = ram_readv,
+	.writev = ram_writev,
+	.peek = ram_peek,
+	.sync = ram_sync,
+};
@@ -0,0 +1,408 @@
+/**
+ * disk_uring.c - Asynchronous disk driver built on io_uring.
+ *
+ * Requests are queued in the submission ring and only handed to the
+ * kernel when completions are reaped, so a batch of block reads costs a
+ * single io_uring_enter() no matter how many requests it contains.
+ * There's no liburing dependency; the rings are set up with the raw
+ * system calls. If the kernel doesn't support io_uring, the disk is
+ * marked as having fallen back and every call is passed to the pio driver.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "disk.h"
+#include "disk_driver.h"
+
+#define RING_ENTRIES 64
+
+struct uring {
+	int fd;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned queued;	// filled in, but not yet handed to the kernel
+
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	unsigned in_flight;	// submitted, but not yet completed
+	unsigned entries;
+
+	void* sq_map;
+	size_t sq_map_len;
+	void* cq_map;
+	size_t cq_map_len;
+	size_t sqes_len;
+};
+
+
+static int ring_setup(struct uring* ring) {
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	// Newer kernels let both rings share one mapping
+	int single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_map && ring->cq_map_len > ring->sq_map_len) {
+		ring->sq_map_len = ring->cq_map_len;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		close(ring->fd);
+		return -1;
+	}
+
+	if (single_map) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			munmap(ring->sq_map, ring->sq_map_len);
+			close(ring->fd);
+			return -1;
+		}
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (!single_map) {
+			munmap(ring->cq_map, ring->cq_map_len);
+		}
+		munmap(ring->sq_map, ring->sq_map_len);
+		close(ring->fd);
+		return -1;
+	}
+
+	unsigned char* sq = ring->sq_map;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	unsigned char* cq = ring->cq_map;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	return 0;
+}
+
+
+static void ring_teardown(struct uring* ring) {
+
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_map != ring->sq_map) {
+		munmap(ring->cq_map, ring->cq_map_len);
+	}
+	munmap(ring->sq_map, ring->sq_map_len);
+	close(ring->fd);
+}
+
+
+// Complete every request sitting in the completion ring
+static int ring_drain(struct disk* disk) {
+
+	struct uring* ring = disk->ring;
+
+	int completed = 0;
+	unsigned head = *ring->cq_head;
+
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+		struct disk_request* req = (struct disk_request*)(uintptr_t)cqe->user_data;
+
+		// A sync has no block and transfers nothing
+		if (cqe->res != (int)req->iov.iov_len) {
+			const char* action = req->block_num < 0 ? "sync" : req->write ? "write" : "read";
+			disk_error(disk, action, req->block_num);
+		}
+
+		head++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+		ring->in_flight--;
+		completed++;
+		req->complete(req);
+	}
+
+	return completed;
+}
+
+
+// Hand everything queued to the kernel, optionally waiting for min_complete
+static void ring_enter(struct disk* disk, unsigned min_complete) {
+
+	struct uring* ring = disk->ring;
+
+	unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+	int ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, min_complete, flags, NULL, 0);
+
+	// Interrupted, or out of room for completions until some are drained:
+	// neither loses anything, so just go again
+	while (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+		ring_drain(disk);
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, min_complete, flags, NULL, 0);
+	}
+	if (ret < 0) {
+		disk_error(disk, "submit I/O to", -1);
+	}
+
+	ring->in_flight += ret;
+	ring->queued -= ret;
+}
+
+
+static int uring_reap(struct disk* disk, int wait) {
+
+	struct uring* ring = disk->ring;
+	int completed = 0;
+
+	if (ring == NULL) {
+		return 0;
+	}
+
+	if (ring->queued > 0) {
+		ring_enter(disk, 0);
+	}
+	completed += ring_drain(disk);
+
+	while (wait && ring->in_flight + ring->queued > 0) {
+		ring_enter(disk, 1);
+		completed += ring_drain(disk);
+	}
+
+	return completed;
+}
+
+
+// Queue a request in the submission ring; its sqe is returned zeroed
+// except for user_data, for the caller to fill in
+static struct io_uring_sqe* ring_queue(struct disk* disk, struct disk_request* req) {
+
+	struct uring* ring = disk->ring;
+
+	// Ring full: push what's queued and make room by completing something
+	while (ring->queued + ring->in_flight >= ring->entries) {
+		ring_enter(disk, 1);
+		ring_drain(disk);
+	}
+
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (unsigned long long)(uintptr_t)req;
+
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+
+	return sqe;
+}
+
+
+static void uring_submit(struct disk* disk, struct disk_request* req) {
+
+	// Without a ring the request is done by the time it's submitted
+	if (disk->ring == NULL) {
+		if (req->write) {
+			pio_driver.writev(disk, req->block_num, &req->iov, 1);
+		} else {
+			pio_driver.readv(disk, req->block_num, &req->iov, 1);
+		}
+		req->complete(req);
+		return;
+	}
+
+	struct io_uring_sqe* sqe = ring_queue(disk, req);
+	sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = disk->fd;
+	sqe->off = (unsigned long long)req->block_num * disk->block_size;
+	sqe->addr = (unsigned long long)(uintptr_t)&req->iov;
+	sqe->len = 1;
+}
+
+
+// Synchronous transfers are just a single request that we wait on
+static void sync_complete(struct disk_request* req) {
+
+	*(int*)req->batch = 1;
+}
+
+
+static void uring_transfer(struct disk* disk, int write, int block_num,
+		const struct iovec* iov, int iovcnt) {
+
+	if (disk->ring == NULL) {
+		if (write) {
+			pio_driver.writev(disk, block_num, iov, iovcnt);
+		} else {
+			pio_driver.readv(disk, block_num, iov, iovcnt);
+		}
+		return;
+	}
+
+	for (int i=0; i<iovcnt; i++) {
+		int done = 0;
+		struct disk_request req = {
+			.write = write,
+			.block_num = block_num,
+			.iov = iov[i],
+			.complete = sync_complete,
+			.batch = &done,
+		};
+
+		uring_submit(disk, &req);
+		while (!done) {
+			ring_enter(disk, 1);
+			ring_drain(disk);
+		}
+
+		block_num += iov[i].iov_len / disk->block_size;
+	}
+}
+
+
+static void uring_read(struct disk* disk, int block_num, unsigned char* buffer) {
+
+	struct iovec iov = { .iov_base = buffer, .iov_len = disk->block_size };
+	uring_transfer(disk, 0, block_num, &iov, 1);
+}
+
+
+static void uring_write(struct disk* disk, int block_num, unsigned char* data) {
+
+	struct iovec iov = { .iov_base = data, .iov_len = disk->block_size };
+	uring_transfer(disk, 1, block_num, &iov, 1);
+}
+
+
+static void uring_readv(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	uring_transfer(disk, 0, block_num, iov, iovcnt);
+}
+
+
+static void uring_writev(struct disk* disk, int block_num, const struct iovec* iov, int iovcnt) {
+
+	uring_transfer(disk, 1, block_num, iov, iovcnt);
+}
+
+
+static const unsigned char* uring_peek(struct disk* disk, int block_num) {
+
+	uring_read(disk, block_num, disk->scratch);
+	return disk->scratch;
+}
+
+
+// Once every write has completed, an fdatasync() behind them in the ring
+// makes them reach the device
+static void uring_sync(struct disk* disk) {
+
+	if (disk->ring == NULL) {
+		pio_driver.sync(disk);
+		return;
+	}
+
+	uring_reap(disk, 1);
+
+	int done = 0;
+	struct disk_request req = {
+		.write = 1,
+		.block_num = -1,
+		.complete = sync_complete,
+		.batch = &done,
+	};
+
+	struct io_uring_sqe* sqe = ring_queue(disk, &req);
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = disk->fd;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+
+	while (!done) {
+		ring_enter(disk, 1);
+		ring_drain(disk);
+	}
+}
+
+
+// If the kernel can't set up a ring, the pio driver does the I/O instead.
+// The disk keeps this driver, so the next mount tries io_uring again.
+static void uring_mount(struct disk* disk) {
+
+	struct uring* ring = calloc(1, sizeof(struct uring));
+
+	if (ring_setup(ring) != 0) {
+		free(ring);
+		disk->fallback = 1;
+		pio_driver.mount(disk);
+		return;
+	}
+
+	disk->ring = ring;
+	disk->scratch = malloc(disk->block_size);
+}
+
+
+static void uring_unmount(struct disk* disk) {
+
+	if (disk->ring == NULL) {
+		pio_driver.unmount(disk);
+		disk->fallback = 0;
+		return;
+	}
+
+	uring_reap(disk, 1);
+	ring_teardown(disk->ring);
+
+	free(disk->ring);
+	disk->ring = NULL;
+	free(disk->scratch);
+	disk->scratch = NULL;
+}
+
+
+const struct disk_driver uring_driver = {
+	.name = "uring",
+	.cacheable = 1,
+	.mount = uring_mount,
+	.unmount = uring_unmount,
+	.read = uring_read,
+	.write = uring_write,
+	.readv = uring_readv,
+	.writev = uring_writev,
+	.submit = uring_submit,
+	.reap = uring_reap,
+	.peek = uring_peek,
+	.sync = uring_sync,
+};
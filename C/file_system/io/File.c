@@ -5,876 +5,3249 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+#include <sys/uio.h>
 
 #include "../disk/disk.h"
+#include "stats.h"
+#include "bitmap.h"
+#include "inode_cache.h"
+#include "dentry_cache.h"
+#include "dir_index.h"
+#include "journal.h"
+#include "File.h"
+
+#define MAGIC_NUMBER 0xBEEF
+#define BYTES_PER_INODE 32768	// how much disk init() sets aside an inode for
+#define DIR_ENTRY_SIZE 32	// a 4-byte inode number, then the name
+#define DIR_NAME_MAX (DIR_ENTRY_SIZE - 5)
+#define DIR_MAX_DEPTH 16	// a directory's bucket table has at most 2^this slots
+#define MAX_PENDING_BYTES (1 << 20)	// delayed data held before flushing on its own
+#define JOURNAL_MAGIC 0x4A524E4C
+#define JOURNAL_FRACTION 32		// init() gives the journal 1 block in this many
+#define MIN_JOURNAL_BLOCKS 16
+
+// Where the simulate_*_crash() functions crash in journal_commit()
+#define CRASH_BEFORE_LOG 1
+#define CRASH_AFTER_LOG 2
+
+// Where everything lives on disk. This is exactly what's stored in the
+// superblock (block 0), one int per field, and gets worked out at init()
+// time from the block size and block count.
+struct superblock {
+	int magic;
+	int num_blocks;
+	int num_inodes;
+	int block_size;
+	int fbv_start;			// free-block vector, 1 bit per block
+	int fbv_blocks;
+	int journal_start;		// write-ahead log of metadata changes, for sys_recover()
+	int journal_blocks;
+	int inode_start;
+	int inode_blocks;
+	int root_block;
+	int data_start;
+	int ibm_start;			// inode bitmap, 1 bit per inode
+	int ibm_blocks;
+	int group_blocks;		// blocks per block group: as many as one FBV block covers
+};
+
+// The journal's first block. The rest of it is a circular log of
+// committed transactions; the ones from tail on might not all have
+// reached their homes yet.
+struct journal_header {
+	int magic;
+	int tail;			// log block the oldest of them starts in
+	int sequence;		// ...and its sequence number
+};
+
+// The start of every log block that isn't a block image. A transaction
+// is one or more descriptors, each followed by the images of the blocks
+// it lists, then a commit record.
+#define JOURNAL_DESCRIPTOR 1
+#define JOURNAL_COMMIT 2
+struct journal_record {
+	int magic;
+	int type;
+	int sequence;
+	int count;			// descriptor: how many block numbers come after it
+	unsigned int checksum;	// commit: of every descriptor and image before it
+};
+
+// The first entry slot of every directory block (see dir_split()). Its
+// inode number is always 0, so it never reads as an entry, and an
+// all-zero block is a directory's one and only bucket.
+struct bucket_header {
+	unsigned int unused;
+	unsigned int depth;		// how many low bits of a name's hash pick this bucket
+	unsigned int bits;		// and what they are
+};
+
+// A data file waiting for delayed allocation (see llfs_flush())
+struct pending_file {
+	char* path;
+	unsigned char* data;
+	int size;
+	int nblocks;
+	int goal;		// the group of its parent directory
+};
+
+// A file opened with llfs_open()
+struct open_file {
+	int in_use;
+	int stale;		// the file's been deleted since
+	int inode_num;
+	char* path;		// for write_to_file()'s messages
+	int size;
+	struct extent* extents;	// all of them, including the ones in map blocks
+	int nextents;
+	int offset;		// for llfs_read() and llfs_write()
+};
+
+// One file system instance: its disk image and everything we keep in
+// memory about it. Instances don't share any state.
+struct llfs {
+	struct disk* disk;
+
+	struct superblock sb;
+	int sb_loaded;
+
+	// The free-block vector and inode bitmap live here between
+	// transactions; commit() writes them back to the disk
+	struct bitmap fbv;
+	struct bitmap ibm;
+
+	// Inodes changed by an operation stay here until commit()
+	struct inode_cache* icache;
+
+	// Name lookups: (directory inode, name) -> inode, and whole directory
+	// paths -> inode
+	struct dentry_cache* dentries;
+	struct dentry_cache* paths;
+
+	// Directory bucket tables, by directory inode
+	struct dir_index_cache* dir_tables;
+
+	// Data files waiting to be made, in order, while delayed allocation
+	// is on
+	int delayed_alloc;
+	struct pending_file* pending;
+	int npending;
+	int pending_blocks;
+	long pending_bytes;
+
+	// Open files, indexed by handle
+	struct open_file* files;
+	int nfiles;
+
+	// The running journal transaction (see journal_commit()): metadata
+	// blocks changed since the last commit, which reads see instead of
+	// what's on disk. NULL until the file system is loaded or formatted.
+	struct journal_txn* running;
+	int group_commit;		// operations per journal commit
+	int group_ops;			// operations in the running transaction so far
+	int in_transaction;		// llfs_begin_transaction() holds off its commit
+	struct bitmap txn_fbv;		// the FBV as of the last commit
+	struct bitmap txn_freed;	// free: blocks to give back to the FBV at the next commit
+	int crash_point;		// for the simulate_*_crash() functions
+
+	// Where the next transaction goes in the log, how many log blocks are
+	// in use from the tail up to there, and the next sequence number
+	int journal_head;
+	int journal_used;
+	int journal_sequence;
+	struct bitmap logged;		// free: blocks logged since the last checkpoint
+
+	struct fs_stats stats;
+};
+
+
+// Get a handle on the disk image at image_path. An existing file system is
+// loaded on first use; a new image has to be formatted with init() first.
+llfs_t* llfs_mount(const char* image_path) {
+
+	llfs_t* fs = calloc(1, sizeof(llfs_t));
+	fs->disk = open_disk(image_path);
+	fs->group_commit = 1;
+	stats_reset(&fs->stats);
+	return fs;
+}
 
-#define NUM_INODES 64
-#define INODE_SIZE 32
 
+// Forget the waiting files without making them
+void discard_pending(llfs_t* fs) {
 
-// Print the indicated block in hexdump-like format; useful for debugging
-void print_block(int block_num) {
+	for (int i=0; i<fs->npending; i++) {
+		free(fs->pending[i].path);
+		free(fs->pending[i].data);
+	}
+	free(fs->pending);
+	fs->pending = NULL;
+	fs->npending = 0;
+	fs->pending_blocks = 0;
+	fs->pending_bytes = 0;
+}
 
-	unsigned char* buffer = malloc(sizeof(char) * BLOCK_SIZE);
-	read_block(block_num, buffer);
 
-	for (int i=0; i<BLOCK_SIZE; i++) {
+// Forget the running transaction and everything it holds, as if it had
+// never started
+void discard_transaction(llfs_t* fs) {
 
-		if (i % 16 == 0) {
-			printf("\nByte %03d:  ", i);
-		}
+	jtxn_destroy(fs->running);
+	fs->running = NULL;
+	fs->group_ops = 0;
+	fs->in_transaction = 0;
+	fs->crash_point = 0;
+	bitmap_destroy(&fs->txn_fbv);
+	bitmap_destroy(&fs->txn_freed);
+	bitmap_destroy(&fs->logged);
+}
 
-		unsigned char b = buffer[i];
-		printf("%02x ", b);
-	} printf("\n");
-	
-	free(buffer);
+
+// Make open files unusable once what's behind them is gone: the ones
+// open on inode_num, or every one if inode_num is 0. They stay open (so
+// their handles aren't handed out again) until they're closed.
+void invalidate_open_files(llfs_t* fs, int inode_num) {
+
+	for (int fd=0; fd<fs->nfiles; fd++) {
+		struct open_file* f = &fs->files[fd];
+		if (f->in_use && (inode_num == 0 || f->inode_num == inode_num)) {
+			f->stale = 1;
+			free(f->extents);
+			f->extents = NULL;
+			f->nextents = 0;
+			free(f->path);
+			f->path = NULL;
+		}
+	}
 }
 
 
-// Read a specific inode into the given buffer
-void read_inode(int inode_num, unsigned char* buffer) {
+// Sync everything to the image and free the handle
+void llfs_unmount(llfs_t* fs) {
 
-	int pos_in_block = ((inode_num % 16) - 1) * INODE_SIZE;
-	int block_num = 4 + (inode_num / 16);
+	if (fs->sb_loaded) {
+		llfs_sync(fs);
+	}
+	discard_transaction(fs);
+	close_disk(fs->disk);
+	bitmap_destroy(&fs->fbv);
+	bitmap_destroy(&fs->ibm);
+	icache_destroy(fs->icache);
+	dcache_destroy(fs->dentries);
+	dcache_destroy(fs->paths);
+	dindex_destroy(fs->dir_tables);
+	invalidate_open_files(fs, 0);
+	free(fs->files);
+	free(fs);
+}
 
-	unsigned char* block_buffer = calloc(BLOCK_SIZE, 1);
-	read_block(block_num, block_buffer);
 
-	memcpy(buffer, block_buffer + pos_in_block, sizeof(char)*32);
+// Save the whole file system to the image file at path. Mostly useful with
+// the ram driver, whose blocks would otherwise be gone after unmounting.
+void llfs_snapshot(llfs_t* fs, const char* image_path) {
 
-	free(block_buffer);
+	if (fs->sb_loaded) {
+		llfs_sync(fs);
+	}
+	snapshot_disk(fs->disk, image_path);
 }
 
 
-// Write the provided data as an inode at the given index
-void write_inode(int inode_num, unsigned char* data) {
+// Replace the file system with the one saved in the image file at path.
+// The image's superblock is checked first, and the disk is switched to its
+// block size so load_disk() copies it in whole blocks.
+void llfs_load(llfs_t* fs, const char* image_path) {
+
+	struct disk* image = open_disk(image_path);
+	set_disk_geometry(image, MIN_BLOCK_SIZE, 1);
+	struct superblock sb;
+	memcpy(&sb, peek_block(image, 0), sizeof(struct superblock));
+	close_disk(image);
 
-	int pos_in_block = ((inode_num % 16) - 1) * INODE_SIZE;
-	int block_num = 4 + (inode_num / 16);
+	if (sb.magic != MAGIC_NUMBER || sb.block_size < MIN_BLOCK_SIZE) {
+		printf("\"%s\" isn't a file system image!\n", image_path);
+		exit(-1);
+	}
 
-	unsigned char* buffer = calloc(BLOCK_SIZE, 1);
-	read_block(block_num, buffer);
+	discard_pending(fs);
+	discard_transaction(fs);
+	invalidate_open_files(fs, 0);
+	set_disk_geometry(fs->disk, sb.block_size, sb.num_blocks);
+	load_disk(fs->disk, image_path);
+	fs->sb_loaded = 0;
+}
 
-	memcpy(buffer + pos_in_block, data, sizeof(char)*32);
-	write_block(block_num, buffer);
 
-	free(buffer);
+// The disk underneath, for picking its driver or reading its cache stats
+struct disk* llfs_disk(llfs_t* fs) {
+
+	return fs->disk;
 }
 
 
-// Find the earliest free block on the disk using the free-block vector
-int find_free_block() {
+// Which part of the layout a block belongs to. Anything past the fixed
+// regions counts as a directory block; data I/O says so explicitly.
+int block_role(llfs_t* fs, int block_num) {
 
-	int earliest_free_block = -1;
+	if (block_num == 0) return ROLE_SUPERBLOCK;
+	if (block_num < fs->sb.fbv_start + fs->sb.fbv_blocks) return ROLE_FBV;
+	if (block_num < fs->sb.ibm_start + fs->sb.ibm_blocks) return ROLE_INODE_BITMAP;
+	if (block_num < fs->sb.inode_start) return ROLE_JOURNAL;
+	if (block_num < fs->sb.root_block) return ROLE_INODE;
+	return ROLE_DIRECTORY;
+}
 
-	unsigned char* fbv = malloc(BLOCK_SIZE);
-	read_block(1, fbv);
 
-	// For each byte in the free-block vector
-	for (int i=0; i<BLOCK_SIZE; i++) {
-		unsigned char b = fbv[i];
+// Whether writes of blocks with this role join the running transaction
+// instead of going straight to the disk. Data goes straight there, and
+// the journal and superblock are written outside any transaction.
+int journaled(llfs_t* fs, int role) {
 
-		// if that byte is > 0, it must indicate one or more free blocks
-		if (b > 0) {
+	return fs->running != NULL
+		&& role != ROLE_DATA && role != ROLE_JOURNAL && role != ROLE_SUPERBLOCK;
+}
 
-			// For each bit in that byte
-			for (int j=0; j<8; j++) {
-				int bit = b >> (7-j);
 
-				// if the bit is 1, we've found our earliest free block!
-				if (bit > 0) {
-					earliest_free_block = (i*8) + j;
-					break;
-				}
-			}
-			break;
+// Copy the running transaction's images over blocks just read from the disk
+void overlay_running(llfs_t* fs, const int* block_nums, int count, unsigned char* buffer) {
+
+	if (jtxn_count(fs->running) == 0) {
+		return;
+	}
+	for (int i=0; i<count; i++) {
+		const unsigned char* image = jtxn_find(fs->running, block_nums[i]);
+		if (image != NULL) {
+			memcpy(buffer + (size_t)i * fs->sb.block_size, image, fs->sb.block_size);
 		}
 	}
-
-	free(fbv);
-	return earliest_free_block;
 }
 
 
-// Find the earliest free inode slot
-int find_free_inode() {
+// Block I/O for the file system goes through these, so it gets counted.
+// Metadata blocks the running transaction has changed are read from it.
+void fs_read_block(llfs_t* fs, int block_num, unsigned char* buffer) {
 
-	for(int i=4; i<5; i++) {
-		unsigned char* buffer = malloc(BLOCK_SIZE);
-		read_block(i, buffer);
+	int role = block_role(fs, block_num);
+	stats_count_io(&fs->stats, role, 0, 1);
 
-		for (int j=0; j<BLOCK_SIZE; j+=32) {
-			int inode_filesize = *(int*)(buffer + j);
-
-			if (inode_filesize == 0) { // Found a free inode slot!
-				return ((i-4)*8 + j/32) + 1;
-			}
-		}
+	const unsigned char* image = journaled(fs, role) ? jtxn_find(fs->running, block_num) : NULL;
+	if (image != NULL) {
+		memcpy(buffer, image, fs->sb.block_size);
+	} else {
+		read_block(fs->disk, block_num, buffer);
 	}
-
-	return -1;
 }
 
 
-// Mark a certain block as "in-use" in the free-block vector
-void mark_block(int block_num) {
+void fs_write_block(llfs_t* fs, int block_num, unsigned char* data) {
 
-	// printf("Marking block %d for use.\n", block_num);
+	int role = block_role(fs, block_num);
+	stats_count_io(&fs->stats, role, 1, 1);
 
-	unsigned char* fbv = malloc(BLOCK_SIZE);
-	read_block(1, fbv);
+	if (journaled(fs, role)) {
+		jtxn_put(fs->running, block_num, data);
+	} else {
+		write_block(fs->disk, block_num, data);
+	}
+}
 
-	int byte_num = (block_num / 8);
-	int bit_num = (block_num % 8);
 
-	unsigned char byte = fbv[byte_num];
-	unsigned char mask = ~(unsigned char)pow(2, 7-bit_num);
-	unsigned char new_byte = (byte & mask);
+const unsigned char* fs_peek_block(llfs_t* fs, int block_num) {
 
-	memcpy(fbv + byte_num, &new_byte, sizeof(char));
-	write_block(1, fbv);
+	int role = block_role(fs, block_num);
+	stats_count_io(&fs->stats, role, 0, 1);
 
-	free(fbv);
+	const unsigned char* image = journaled(fs, role) ? jtxn_find(fs->running, block_num) : NULL;
+	return (image != NULL) ? image : peek_block(fs->disk, block_num);
 }
 
 
-// Unmark a certain block to indicate it is free
-void unmark_block(int block_num) {
+void fs_read_blocks(llfs_t* fs, int role, const int* block_nums, int count, unsigned char* buffer) {
 
-	// printf("Unmarking block %d\n", block_num);
+	stats_count_io(&fs->stats, role, 0, count);
+	read_blocks(fs->disk, block_nums, count, buffer);
+	if (journaled(fs, role)) {
+		overlay_running(fs, block_nums, count, buffer);
+	}
+}
 
-	unsigned char* fbv = malloc(BLOCK_SIZE);
-	read_block(1, fbv);
 
-	int byte_num = (block_num / 8);
-	int bit_num = (block_num % 8);
+void fs_write_blocks(llfs_t* fs, int role, const int* block_nums, int count, unsigned char* data) {
 
-	unsigned char byte = fbv[byte_num];
-	unsigned char mask = (unsigned char)pow(2, 7-bit_num);
-	unsigned char new_byte = (byte | mask);
+	stats_count_io(&fs->stats, role, 1, count);
+	if (!journaled(fs, role)) {
+		write_blocks(fs->disk, block_nums, count, data);
+		return;
+	}
+	for (int i=0; i<count; i++) {
+		jtxn_put(fs->running, block_nums[i], data + (size_t)i * fs->sb.block_size);
+	}
+}
 
-	memcpy(fbv + byte_num, &new_byte, sizeof(char));
-	write_block(1, fbv);
 
-	free(fbv);
-}
+void fs_read_range(llfs_t* fs, int start, int count, unsigned char* buffer) {
 
+	int role = block_role(fs, start);
+	stats_count_io(&fs->stats, role, 0, count);
+	read_block_range(fs->disk, start, count, buffer);
+	if (journaled(fs, role)) {
+		for (int i=0; i<count; i++) {
+			const unsigned char* image = jtxn_find(fs->running, start + i);
+			if (image != NULL) {
+				memcpy(buffer + (size_t)i * fs->sb.block_size, image, fs->sb.block_size);
+			}
+		}
+	}
+}
 
-// Split a string by the given delimiter
-char** str_split(char* str, const char* delim) {
 
-	// printf("Splitting \'%s\' with delim \'%s\'\n", str, delim);
+void fs_write_range(llfs_t* fs, int start, int count, unsigned char* data) {
 
-	char** buffer = (char**)malloc(sizeof(char*) * 16);
-	for (int i=0; i<16; i++) {
-		buffer[i] = (char*)malloc(sizeof(char) * 128);
+	int role = block_role(fs, start);
+	stats_count_io(&fs->stats, role, 1, count);
+	if (!journaled(fs, role)) {
+		write_block_range(fs->disk, start, count, data);
+		return;
 	}
+	for (int i=0; i<count; i++) {
+		jtxn_put(fs->running, start + i, data + (size_t)i * fs->sb.block_size);
+	}
+}
 
-	char str_arr[128];
-	strcpy(str_arr, str);
 
-	int i = 0;
-	char* token;
+// Read a bitmap of num_bits items, stored in nblocks blocks from start,
+// off the disk into memory
+void load_bitmap(llfs_t* fs, struct bitmap* bm, int num_bits, int start, int nblocks) {
 
-	token = strtok(str_arr, delim);
-	while (token != NULL) {
-		memcpy(buffer[i], token, strlen(token)+1);
-		// printf("Wrote %s to buffer[%d]\n", token, i);
-		i++;
+	unsigned char* buffer = malloc((size_t)nblocks * fs->sb.block_size);
+	fs_read_range(fs, start, nblocks, buffer);
 
-		token = strtok(NULL, delim);
-	}
-	buffer[i] = 0;
+	bitmap_destroy(bm);
+	bitmap_create(bm, num_bits);
+	bitmap_load(bm, buffer);
 
-	return buffer;
+	free(buffer);
 }
 
 
-// Write an entry in a parent directory block for a child file
-void write_entry_to_parent(int child_inode, char* child_fn, int parent_block) {
+// Write an in-memory bitmap out to its nblocks blocks at start. Only the
+// blocks that changed are written.
+void store_bitmap(llfs_t* fs, struct bitmap* bm, int start, int nblocks) {
 
-	// Find the earliest free entry in the parent block
-	unsigned char* buffer = malloc(sizeof(char) * BLOCK_SIZE);
-	read_block(parent_block, buffer);
-
-	int entry_num = -1;
-
-	for (int i=0; i<BLOCK_SIZE; i += 32) {
-		unsigned char byte = buffer[i];
-		if (byte == 0) {
-			entry_num = i/32;
-			break;
+	unsigned char* buffer = calloc(nblocks, fs->sb.block_size);
+	bitmap_store(bm, buffer);
+	for (int i=0; i<nblocks; i++) {
+		unsigned char* block = buffer + (size_t)i * fs->sb.block_size;
+		if (memcmp(block, fs_peek_block(fs, start + i), fs->sb.block_size) != 0) {
+			fs_write_block(fs, start + i, block);
 		}
 	}
+	free(buffer);
+}
 
-	if (entry_num == -1) {
-		printf("The specified directory is already full!\n");
-		return;
-	}
 
-	// printf("Entry %d is free\n", entry_num);
+/**
+ * The journal. Operations don't write metadata (inodes, directories,
+ * extent blocks and the bitmaps) in place: the blocks they change wait
+ * in the running transaction, and journal_commit() writes all of them
+ * to the log, one after another, before any goes home. After a crash,
+ * the next mount replays every transaction the log holds in full, so
+ * each one happened completely or not at all, however many blocks it
+ * changed. When the log fills up, checkpoint() makes sure everything in
+ * it is home, and it starts over.
+ */
 
-	// Construct the entry in the parent directory
-	unsigned char child_inode_byte = (unsigned char)child_inode;
-	unsigned char* entry = calloc(32, sizeof(char));
-	memcpy(entry, &child_inode_byte, 1);
-	memcpy(entry + 1, child_fn, strlen(child_fn) + 1);
+// How many blocks of the journal are log, after its header
+int log_blocks(llfs_t* fs) {
 
-	// Write the entry to the parent block's buffer
-	memcpy(buffer + (entry_num * 32), entry, 32);
+	return fs->sb.journal_blocks - 1;
+}
 
-	// Write the block back onto the disk
-	write_block(parent_block, buffer);
 
-	free(entry);
-	free(buffer);
+// How many log blocks a transaction of count block images takes: the
+// images, a descriptor for every run of them, and the commit record
+int transaction_log_blocks(llfs_t* fs, int count) {
+
+	int per_descriptor = (fs->sb.block_size - (int)sizeof(struct journal_record)) / (int)sizeof(int);
+	return (count + per_descriptor - 1) / per_descriptor + count + 1;
 }
 
 
-// Traverse the directory tree to find the data block of the direct parent directory
-int find_parent_block(char* path) {
+// The disk block log block i is in, wrapping around the end of the log
+int log_block(llfs_t* fs, int i) {
 
-	// Split up the path by forward slashes
-	const char* fslash = "/";
-	char** split_path = str_split(path, fslash);
+	return fs->sb.journal_start + 1 + i % log_blocks(fs);
+}
 
-	// Figure out how long the path is
-	int path_len = 0;
-	for ( ; split_path[path_len] != NULL; path_len++);
 
-	int parent_block = 10; // tree traversal always starts at the root (block 10)
+// Send a logged block home. Its write was counted when it joined the
+// transaction, so it isn't counted again.
+void write_home(llfs_t* fs, int block_num, const unsigned char* image) {
 
-	// We only need to traverse if the new directory isn't being made in root
-	if (path_len > 1) {
+	write_block(fs->disk, block_num, (unsigned char*)image);
+}
 
-		// Initial traversal setup; this is where things get a little complicated
-		int depth = 0;
-		int current_inode = 1; // root is always inode 1
-		char* current_dir = "";
-		char* goal_dir = split_path[path_len - 2];
-		unsigned char* inode_buffer = malloc(INODE_SIZE);
-		unsigned char* block_buffer = malloc(BLOCK_SIZE);
 
-		// Traverse until we've hit the goal parent directory
-		while (strcmp(current_dir, goal_dir) != 0) {
-			int found = 0;
+// Say where a replay would start: at the head, with the next sequence number
+void write_journal_header(llfs_t* fs) {
 
-			read_block(parent_block, block_buffer);
+	struct journal_header header = { JOURNAL_MAGIC, fs->journal_head, fs->journal_sequence };
+	unsigned char* buffer = calloc(fs->sb.block_size, 1);
+	memcpy(buffer, &header, sizeof(header));
+	fs_write_block(fs, fs->sb.journal_start, buffer);
+	free(buffer);
+}
 
-			// For each entry in the directory block
-			int current_entry = 0;
-			for ( ; current_entry<16; current_entry++) {
 
-				// Convert the entry's hex filename to a readable string
-				char* entry_fn = (char*)&(block_buffer[(current_entry*32)+1]);
+// Make sure every block the log holds is home, then empty the log
+void checkpoint(llfs_t* fs) {
 
-				// If it's the same as the one we're looking for, we're done
-				if (strcmp(entry_fn, split_path[depth]) == 0) {
-					current_dir = entry_fn;
-					found = 1;
-					break;
-				}
-			}
+	// The homes have to be on disk before the header stops pointing at
+	// their copies, and the header before the log wraps over them
+	sync_disk(fs->disk);
+	write_journal_header(fs);
+	sync_disk(fs->disk);
 
-			if (!found) {
-				printf("The file \'%s\' does not exist!\n", split_path[depth]);
-				exit(-1);
-			}
+	fs->journal_used = 0;
+	bitmap_destroy(&fs->logged);
+	bitmap_create(&fs->logged, fs->sb.num_blocks);
+}
 
-			current_inode = block_buffer[current_entry*32];
-			read_inode(current_inode, inode_buffer);
 
-			int* inode_flags = (int*)(inode_buffer + 4);
-			if (*inode_flags != 0) {
-				printf("The file \'%s\' is not a directory!\n", split_path[depth]);
-				exit(-1);
+// Read the transaction with the given sequence number out of the log,
+// from log block pos: the blocks it changed and their images. Returns how
+// many log blocks it takes up, or 0 if it isn't there in full with a
+// matching checksum, which means it never committed.
+int read_logged_transaction(llfs_t* fs, int pos, int sequence,
+		int** block_nums, unsigned char** images, int* count) {
+
+	int bs = fs->sb.block_size;
+	int per_descriptor = (bs - (int)sizeof(struct journal_record)) / (int)sizeof(int);
+	unsigned char* block = malloc(bs);
+	struct journal_record record;
+	unsigned int sum = 0;
+	int used = 0;
+	int whole = -1;
+
+	*block_nums = NULL;
+	*images = NULL;
+	*count = 0;
+
+	while (whole < 0) {
+		if (used >= log_blocks(fs)) {
+			whole = 0;
+			break;
+		}
+		fs_read_block(fs, log_block(fs, pos + used++), block);
+		memcpy(&record, block, sizeof(record));
+
+		if (record.magic != JOURNAL_MAGIC || record.sequence != sequence) {
+			whole = 0;
+		} else if (record.type == JOURNAL_COMMIT) {
+			whole = (record.checksum == sum);
+		} else if (record.type != JOURNAL_DESCRIPTOR || record.count < 1
+				|| record.count > per_descriptor || used + record.count >= log_blocks(fs)) {
+			whole = 0;
+		} else {
+			sum = journal_checksum(sum, block, bs);
+
+			int n = *count + record.count;
+			*block_nums = realloc(*block_nums, sizeof(int) * n);
+			*images = realloc(*images, (size_t)n * bs);
+			memcpy(*block_nums + *count, block + sizeof(record), sizeof(int) * record.count);
+
+			for (int i=*count; i<n; i++) {
+				unsigned char* image = *images + (size_t)i * bs;
+				fs_read_block(fs, log_block(fs, pos + used++), image);
+				sum = journal_checksum(sum, image, bs);
+				if ((*block_nums)[i] <= 0 || (*block_nums)[i] >= fs->sb.num_blocks) {
+					whole = 0;
+				}
 			}
-
-			parent_block = inode_buffer[8] + (inode_buffer[9] << 8);
-			depth++;
+			*count = n;
 		}
-
-		free(inode_buffer);
-		free(block_buffer);
 	}
 
-	return parent_block;
+	free(block);
+	return whole ? used : 0;
 }
 
 
-// Find the inode of the file at the end of the given path
-int find_inode_num(char* path) {
-
-	// Split up the path by forward slashes
-	const char* fslash = "/";
-	char** split_path = str_split(path, fslash);
+// Put every committed transaction in the log where it belongs, oldest
+// first, then empty the log. The first one that isn't there in full
+// never committed, and nothing from there on is replayed.
+void journal_replay(llfs_t* fs) {
 
-	// Figure out how long the path is
-	int path_len = 0;
-	for ( ; split_path[path_len] != NULL; path_len++);
+	struct journal_header header;
+	memcpy(&header, fs_peek_block(fs, fs->sb.journal_start), sizeof(header));
+	if (header.magic != JOURNAL_MAGIC) {
+		printf("The journal is corrupted!\n");
+		exit(-1);
+	}
 
-	// Get the block number of the file's parent
-	int parent_block = find_parent_block(path);
+	fs->journal_head = header.tail;
+	fs->journal_sequence = header.sequence;
+	fs->journal_used = 0;
+
+	int ntxns = 0;
+	int nblocks = 0;
+	int used;
+	do {
+		int* block_nums;
+		unsigned char* images;
+		int count;
+		used = read_logged_transaction(fs, fs->journal_head, fs->journal_sequence,
+				&block_nums, &images, &count);
+
+		if (used > 0) {
+			for (int i=0; i<count; i++) {
+				write_home(fs, block_nums[i], images + (size_t)i * fs->sb.block_size);
+			}
+			fs->journal_head = (fs->journal_head + used) % log_blocks(fs);
+			fs->journal_sequence++;
+			ntxns++;
+			nblocks += count;
+		}
 
-	// Traverse 1 extra level to get to our data file's inode
-	unsigned char* block_buffer = malloc(BLOCK_SIZE);
-	read_block(parent_block, block_buffer);
+		free(images);
+		free(block_nums);
+	} while (used > 0);
 
-	int found = 0;
-	int current_entry = 0;
-	for ( ; current_entry<16; current_entry++) {
-		char* entry_fn = (char*)(block_buffer + (current_entry*32+1));
+	bitmap_destroy(&fs->logged);
+	bitmap_create(&fs->logged, fs->sb.num_blocks);
 
-		if (strcmp(entry_fn, split_path[path_len-1]) == 0) {
-			found = 1;
-			break;
-		}
-	}
-	if (!found) {
-		printf("The file \'%s\' does not exist!\n", split_path[path_len-1]);
-		exit(-1);
+	if (ntxns > 0) {
+		printf("Replayed %d committed transactions (%d blocks) from the journal\n\n", ntxns, nblocks);
+		checkpoint(fs);
 	}
+}
+
 
-	char current_inode = block_buffer[current_entry*32];
-	free(block_buffer);
+// Start a new running transaction, once the last one has committed (or
+// the file system has been loaded or formatted)
+void start_running(llfs_t* fs) {
 
-	return (int)current_inode;
+	if (fs->running == NULL) {
+		fs->running = jtxn_create(fs->sb.block_size);
+	} else {
+		jtxn_clear(fs->running);
+	}
+	fs->group_ops = 0;
+
+	bitmap_destroy(&fs->txn_fbv);
+	bitmap_copy(&fs->txn_fbv, &fs->fbv);
+	bitmap_destroy(&fs->txn_freed);
+	bitmap_create(&fs->txn_freed, fs->sb.num_blocks);
 }
 
 
-// If the the file system crashed, recover the previous disk state
-void sys_recover() {
+// Start the in-memory caches over, for a file system that's just been
+// loaded or formatted
+void reset_caches(llfs_t* fs) {
 
-	printf("Recovering disk state...\n\n");
+	icache_destroy(fs->icache);
+	dcache_destroy(fs->dentries);
+	dcache_destroy(fs->paths);
+	dindex_destroy(fs->dir_tables);
+
+	fs->icache = icache_create(DEFAULT_INODE_CACHE_SIZE);
+	fs->dentries = dcache_create(DEFAULT_DENTRY_CACHE_SIZE);
+	fs->paths = dcache_create(DEFAULT_DENTRY_CACHE_SIZE);
+	fs->dir_tables = dindex_create(DEFAULT_DIR_INDEX_CACHE_SIZE);
+}
 
-	unsigned char* block_buffer = malloc(BLOCK_SIZE);
-	read_block(2, block_buffer);
 
-	if (block_buffer[0] == 1) { // There was a crash! Restore the disk!
+// Load the superblock of an existing disk if we haven't formatted one ourselves
+void mount_fs(llfs_t* fs) {
 
-		// Get all the metadata from the safety block
-		short parent_block_num = *(short*)(block_buffer+1);
-		char entry_num = *(char*)(block_buffer+3);
-		char inode_num = *(char*)(block_buffer+4);
+	if (fs->sb_loaded) {
+		return;
+	}
 
-		// restore parent block state (entry)
-		unsigned char* parent_buffer = malloc(BLOCK_SIZE);
-		unsigned char* entry_buffer = malloc(32);
+	// The fields we need sit at the front of block 0, so any block size will do
+	set_disk_geometry(fs->disk, MIN_BLOCK_SIZE, 1);
+	memcpy(&fs->sb, fs_peek_block(fs, 0), sizeof(struct superblock));
 
-		read_block(parent_block_num, parent_buffer);
-		memcpy(entry_buffer, block_buffer+32, 32);
+	if (fs->sb.magic != MAGIC_NUMBER || fs->sb.block_size < MIN_BLOCK_SIZE) {
+		printf("The disk hasn't been formatted with init()!\n");
+		exit(-1);
+	}
 
-		// write the entry back into the parent
-		memcpy(parent_buffer + (entry_num*32), entry_buffer, 32);
-		write_block(parent_block_num, parent_buffer);
+	set_disk_geometry(fs->disk, fs->sb.block_size, fs->sb.num_blocks);
+	fs->sb_loaded = 1;
 
-		// restore the inode
-		memcpy(entry_buffer, block_buffer+64, 32);
-		write_inode((int)inode_num, entry_buffer);
+	// Finish what committed before the last crash, so the bitmaps come
+	// off the disk up to date
+	discard_transaction(fs);
+	journal_replay(fs);
 
-		// lower the "working" flag
-		char zero = 0;
-		memcpy(block_buffer, &zero, 1);
-		write_block(2, block_buffer);
+	load_bitmap(fs, &fs->fbv, fs->sb.num_blocks, fs->sb.fbv_start, fs->sb.fbv_blocks);
+	load_bitmap(fs, &fs->ibm, fs->sb.num_inodes, fs->sb.ibm_start, fs->sb.ibm_blocks);
 
-		// restore the FBV
-		read_block(3, block_buffer);
-		write_block(1, block_buffer);
+	reset_caches(fs);
+	start_running(fs);
+}
 
-		free(entry_buffer);
-		free(parent_buffer);
-	}
-	
-	free(block_buffer);
+
+// Lose everything that's only in memory, as a crash would. The next
+// operation mounts the file system again, which replays the journal.
+void crash(llfs_t* fs) {
+
+	discard_pending(fs);
+	discard_transaction(fs);
+	reset_caches(fs);
+	fs->sb_loaded = 0;
 }
 
 
-// Commit changes to the disk
-// This should be called at the end of each disk-modifying operation
-void commit() {
+// Dump the I/O counters and latencies gathered so far, as text or JSON
+void print_stats(llfs_t* fs, int as_json) {
 
-	// Lower the "working" flag
-	unsigned char* block_buffer = malloc(BLOCK_SIZE);
-	read_block(2, block_buffer);
+	struct cache_stats cache;
+	get_cache_stats(fs->disk, &cache);
+	fs->stats.cache_hits = cache.hits;
+	fs->stats.cache_misses = cache.misses;
+	fs->stats.cache_writebacks = cache.writebacks;
 
-	char zero = 0;
-	memcpy(block_buffer, &zero, 1);
+	if (fs->icache != NULL) {
+		icache_get_stats(fs->icache, &fs->stats.inode_hits, &fs->stats.inode_misses);
+		dcache_get_stats(fs->dentries, &fs->stats.dentry_hits, &fs->stats.dentry_misses);
+		dcache_get_stats(fs->paths, &fs->stats.path_hits, &fs->stats.path_misses);
+	}
 
-	write_block(2, block_buffer);
+	stats_print(&fs->stats, stdout, as_json);
 }
 
 
-// Back up the corruptable disk sections when modifying the file @ path
-// This should be called at the beginning of each disk-modifying operation
-void begin(char* path) {
+void reset_stats(llfs_t* fs) {
 
-	char inode_num = (char)find_free_inode();
+	stats_reset(&fs->stats);
+}
 
-	unsigned char* safety_buffer = calloc(BLOCK_SIZE, 1);
-	char one = 1;
-	memcpy(safety_buffer, &one, 1); // "working" flag
 
-	// Find + backup the parent directory block + entry number + entry
-	const char* fslash = "/";
-	char** split_path = str_split(path, fslash);
-	int path_len = 0;
-	for ( ; split_path[path_len] != NULL; path_len++);
-	short parent_block_num = (short)find_parent_block(path);
+// Print the indicated block in hexdump-like format; useful for debugging
+void print_block(llfs_t* fs, int block_num) {
 
-	memcpy(safety_buffer+1, &parent_block_num, 2);
+	mount_fs(fs);
 
-	unsigned char* block_buffer = malloc(BLOCK_SIZE);
-	read_block(parent_block_num, block_buffer);
+	unsigned char* buffer = malloc(sizeof(char) * fs->sb.block_size);
+	fs_read_block(fs, block_num, buffer);
 
-	char first_free_entry = -1;
-	char entry_num = -1;
-	unsigned char* entry_buffer = calloc(32, 1);
-	for (int i=0; i<BLOCK_SIZE; i+=32) {
-		char* current_entry = (char*)(block_buffer + i);
+	for (int i=0; i<fs->sb.block_size; i++) {
 
-		if (*current_entry == 0 && first_free_entry == -1) {
-			first_free_entry = i/32;
+		if (i % 16 == 0) {
+			printf("\nByte %03d:  ", i);
 		}
 
-		if (strcmp(split_path[path_len-1], current_entry+1) == 0){
-			inode_num = *current_entry;
-			entry_num = i/32;
-			memcpy(entry_buffer, current_entry, 32);
-		}
-	}
-	if (entry_num == -1) {
-		entry_num = first_free_entry;
-	}
+		unsigned char b = buffer[i];
+		printf("%02x ", b);
+	} printf("\n");
+	
+	free(buffer);
+}
 
-	memcpy(safety_buffer+3, &entry_num, 1);
-	memcpy(safety_buffer+4, &inode_num, 1);
-	memcpy(safety_buffer+32, entry_buffer, 32);
 
-	// Back up the FBV to block 3
-	read_block(1, block_buffer);
-	write_block(3, block_buffer);
+// Which inode block an inode lives in
+int inode_block(llfs_t* fs, int inode_num) {
 
-	// Find + backup the file's inode
-	free(entry_buffer);
-	entry_buffer = calloc(32, 1);
-	if (inode_num) { // The file has an inode (aka, it exists on disk)
-		read_inode(inode_num, entry_buffer);
-	}
-	memcpy(safety_buffer + 64, entry_buffer, 32);
+	return fs->sb.inode_start + (inode_num - 1) / (fs->sb.block_size / INODE_SIZE);
+}
 
-	// Write all this stuff to the safety block (block 2)
-	write_block(2, safety_buffer);
 
+// Where in its inode block an inode starts
+int inode_offset(llfs_t* fs, int inode_num) {
 
-	free(entry_buffer);
-	free(block_buffer);
-	free(safety_buffer);
-	free(split_path);
+	return ((inode_num - 1) % (fs->sb.block_size / INODE_SIZE)) * INODE_SIZE;
 }
 
 
-// Make a directory file at the given path
-void make_dir(char* path) {
+// Read a specific inode, from the inode cache if it's there
+void read_inode(llfs_t* fs, int inode_num, struct inode* inode) {
 
-	begin(path);
+	if (icache_get(fs->icache, inode_num, inode)) {
+		return;
+	}
 
-	// Split up the path by forward slashes
-	const char* fslash = "/";
-	char** split_path = str_split(path, fslash);
+	const unsigned char* block_buffer = fs_peek_block(fs, inode_block(fs, inode_num));
+	memcpy(inode, block_buffer + inode_offset(fs, inode_num), INODE_SIZE);
+	icache_fill(fs->icache, inode_num, inode);
+}
 
-	// Figure out how long the path is
-	int path_len = 0;
-	for ( ; split_path[path_len] != NULL; path_len++);
 
-	// Next, we need to traverse the tree to find where to make the new directory
-	int parent_block = find_parent_block(path);
+// Change an inode. This only touches the inode cache; commit() writes
+// it out with write_back_inodes().
+void write_inode(llfs_t* fs, int inode_num, const struct inode* inode) {
 
-	// Find some free space to write our new directory to
-	int inode_num = find_free_inode();
-	int block_num = find_free_block();
+	icache_put(fs->icache, inode_num, inode);
+}
 
-	// Write an entry in the parent directory's block
-	write_entry_to_parent(inode_num, split_path[path_len-1], parent_block);
 
-	// Construct an inode for the new directory
-	unsigned char* buffer = calloc(32, 1);
+// Write every dirty inode back to its inode block, each block once
+void write_back_inodes(llfs_t* fs) {
 
-	unsigned int size = 512;
-	memcpy(buffer, &size, sizeof(int));
+	int ndirty = icache_num_dirty(fs->icache);
+	if (ndirty == 0) {
+		return;
+	}
 
-	unsigned int flags = 0; // indicates this file is a directory
-	memcpy(buffer + 4, &flags, sizeof(int));
+	int* inode_nums = malloc(sizeof(int) * ndirty);
+	struct inode* inodes = malloc(sizeof(struct inode) * ndirty);
+	icache_clean(fs->icache, inode_nums, inodes);
 
-	// For simplicity, each directory will only use 1 block
-	unsigned short short_blocknum = (unsigned short)block_num;
-	for (int i=0; i<10; i++) {
-		int offset = 8 + (i*2);
-		memcpy(buffer + offset, &short_blocknum, sizeof(short));
-	}
+	// They come out in inode order, so each block's inodes are together
+	unsigned char* buffer = malloc(fs->sb.block_size);
+	for (int i=0; i<ndirty; ) {
+		int block_num = inode_block(fs, inode_nums[i]);
+		fs_read_block(fs, block_num, buffer);
 
-	// Single/double indirect blocks? idk what these fields mean
-	unsigned short zero = 0;
-	memcpy(buffer + 28, &zero, sizeof(short));
-	memcpy(buffer + 30, &zero, sizeof(short));
+		for ( ; i<ndirty && inode_block(fs, inode_nums[i]) == block_num; i++) {
+			memcpy(buffer + inode_offset(fs, inode_nums[i]), &inodes[i], INODE_SIZE);
+		}
 
-	write_inode(inode_num, buffer);
-	free(buffer);
+		fs_write_block(fs, block_num, buffer);
+	}
 
-	// Veryify that the directory's block on disk is zero-initialized
-	unsigned char* zbuffer = calloc(BLOCK_SIZE, 1);
-	write_block(block_num, zbuffer);
-	free(zbuffer);
+	free(buffer);
+	free(inodes);
+	free(inode_nums);
+}
 
-	mark_block(block_num); // Mark the directory's block as in-use
 
-	printf("Created a directory at \'%s\':\nParent block %d, inode # %d, storage block %d\n\n",
-			path, parent_block, inode_num, block_num);
+// Give blocks from start up to (not including) end back to the FBV. The
+// ones that were in use at the last journal commit are held back until
+// the next, so nothing written straight to the disk before then lands on
+// data that a crash would bring back. What the running transaction has
+// for them is dropped, so a replay can't write it over their next use.
+void free_blocks(llfs_t* fs, int start, int end) {
 
-	// Free the split path buffer
-	for (int i=0; i<5; i++) {
-		free(split_path[i]);
-	} free(split_path);
+	if (fs->running == NULL) {
+		bitmap_unmark_range(&fs->fbv, start, end);
+		return;
+	}
 
-	commit();
+	for (int i=start; i<end; i++) {
+		jtxn_forget(fs->running, i);
+		if (bitmap_is_free(&fs->txn_fbv, i)) {
+			bitmap_unmark(&fs->fbv, i);
+		} else {
+			bitmap_unmark(&fs->txn_freed, i);
+		}
+	}
 }
 
 
-/**
- * Make a data file at the given path, provided some data and its size.
- * If you pass an inaccurate data size, you're going to get garbage
- * in the data blocks. So don't do that. Please.
- */
-void make_datafile(char* path, unsigned char* data, int data_size) {
+// Give the blocks of some extents back to the FBV
+void free_extents(llfs_t* fs, const struct extent* extents, int count) {
 
-	begin(path);
+	for (int i=0; i<count; i++) {
+		free_blocks(fs, extents[i].start, extents[i].start + extents[i].length);
+	}
+}
 
-	// Split up the path by forward slashes
-	const char* fslash = "/";
-	char** split_path = str_split(path, fslash);
 
-	// Figure out how long the path is
-	int path_len = 0;
-	for ( ; split_path[path_len] != NULL; path_len++);
+// Commit the running transaction: log every block it changed, and once
+// the log is on disk, send them home. What it freed can be reused from
+// then on. Returns how many blocks it logged.
+int journal_commit(llfs_t* fs) {
 
-	// Set up the file's metadata
-	int parent_block = find_parent_block(path);
-	int inode_num = find_free_inode();
-	write_entry_to_parent(inode_num, split_path[path_len-1], parent_block);
+	// The inodes and allocations reach their blocks now, all at once
+	write_back_inodes(fs);
+	bitmap_merge_free(&fs->fbv, &fs->txn_freed);
 
-	// Figure out which blocks we'll use to store the data (1 or more)
-	int nblocks = (data_size / (BLOCK_SIZE+1)) + 1;
-	unsigned char* block_nums = calloc(nblocks, 1);
-	for (int i=0; i<nblocks; i++) {
-		int next_blocknum = find_free_block();
-		block_nums[i] = next_blocknum;
-		mark_block(next_blocknum);
+	if (fs->fbv.dirty) {
+		store_bitmap(fs, &fs->fbv, fs->sb.fbv_start, fs->sb.fbv_blocks);
+		fs->fbv.dirty = 0;
+	}
+	if (fs->ibm.dirty) {
+		store_bitmap(fs, &fs->ibm, fs->sb.ibm_start, fs->sb.ibm_blocks);
+		fs->ibm.dirty = 0;
 	}
 
-	// Construct an inode for the new data file
-	unsigned char* inode_buffer = calloc(32, 1);
+	if (fs->crash_point == CRASH_BEFORE_LOG) {
+		crash(fs);
+		return 0;
+	}
 
-	memcpy(inode_buffer, &data_size, sizeof(int));
+	int count = jtxn_count(fs->running);
+	if (count == 0) {
+		start_running(fs);
+		return 0;
+	}
 
-	unsigned int flags = 1; // indicates this file is a data file
-	memcpy(inode_buffer + 4, &flags, sizeof(int));
+	int bs = fs->sb.block_size;
+	int per_descriptor = (bs - (int)sizeof(struct journal_record)) / (int)sizeof(int);
+	int total = transaction_log_blocks(fs, count);
+	if (total > log_blocks(fs)) {
+		printf("The transaction is too big for the journal!\n");
+		exit(-1);
+	}
+	if (fs->journal_used + total > log_blocks(fs)) {
+		checkpoint(fs);
+	}
 
-	// For simplicity, each directory will only use 1 block
-	unsigned short short_blocknum;
-	for (int i=0; i<10; i++) {
-		if (i < nblocks) {
-			short_blocknum = (unsigned short)block_nums[i];
-		} else {
-			short_blocknum = (unsigned short)block_nums[nblocks-1];
+	// Each descriptor, then the images of the blocks it lists, then the
+	// commit record with a checksum of all of them
+	unsigned char* log = calloc(total, bs);
+	struct journal_record record = { JOURNAL_MAGIC, JOURNAL_DESCRIPTOR, fs->journal_sequence, 0, 0 };
+	unsigned int sum = 0;
+	int n = 0;
+	for (int i=0; i<count; i += per_descriptor) {
+		unsigned char* descriptor = log + (size_t)n * bs;
+		record.count = (count - i < per_descriptor) ? count - i : per_descriptor;
+		memcpy(descriptor, &record, sizeof(record));
+
+		int* block_nums = (int*)(descriptor + sizeof(record));
+		for (int j=0; j<record.count; j++) {
+			const unsigned char* image;
+			block_nums[j] = jtxn_block(fs->running, i + j, &image);
+			memcpy(descriptor + (size_t)(j + 1) * bs, image, bs);
 		}
+		sum = journal_checksum(sum, descriptor, (record.count + 1) * bs);
+		n += record.count + 1;
+	}
+	record.type = JOURNAL_COMMIT;
+	record.count = 0;
+	record.checksum = sum;
+	memcpy(log + (size_t)n * bs, &record, sizeof(record));
+
+	int* log_nums = malloc(sizeof(int) * total);
+	for (int i=0; i<total; i++) {
+		log_nums[i] = log_block(fs, fs->journal_head + i);
+	}
 
-		int offset = 8 + (i*2);
-		memcpy(inode_buffer + offset, &short_blocknum, sizeof(short));
+	// Data the transaction points to goes first. The checksum catches a
+	// log that only partly made it, so it can all go in one sequential
+	// write with one sync after it.
+	flush_cache(fs->disk);
+	fs_write_blocks(fs, ROLE_JOURNAL, log_nums, total, log);
+	sync_disk(fs->disk);
+	free(log_nums);
+	free(log);
+
+	fs->journal_head = (fs->journal_head + total) % log_blocks(fs);
+	fs->journal_used += total;
+	fs->journal_sequence++;
+
+	if (fs->crash_point == CRASH_AFTER_LOG) {
+		crash(fs);
+		return count;
 	}
 
-	// Single/double indirect blocks? idk what these fields mean
-	unsigned short zero = 0;
-	memcpy(inode_buffer + 28, &zero, sizeof(short));
-	memcpy(inode_buffer + 30, &zero, sizeof(short));
+	for (int i=0; i<count; i++) {
+		const unsigned char* image;
+		int block_num = jtxn_block(fs->running, i, &image);
+		write_home(fs, block_num, image);
+		bitmap_unmark(&fs->logged, block_num);
+	}
 
-	write_inode(inode_num, inode_buffer);
-	free(inode_buffer);
+	// A logged block that's free now could be reused for data, which a
+	// replay of its old image would then wipe out. Rather than log that
+	// it's gone, empty the log.
+	if (bitmap_shares_free(&fs->fbv, &fs->logged)) {
+		checkpoint(fs);
+	}
 
-	// Write the actual data to the disk
-	unsigned char* block_buffer;
-	for (int i=0; i<nblocks; i++) {
+	start_running(fs);
+	return count;
+}
 
-		int chunk_size;
-		if (i == nblocks-1) {
-			if ((data_size % BLOCK_SIZE) == 0) {
-				chunk_size = BLOCK_SIZE;
-			} else {
-				chunk_size = data_size % BLOCK_SIZE;
-			}
-		} else {
-			chunk_size = BLOCK_SIZE;
-		}
 
-		block_buffer = calloc(BLOCK_SIZE, 1);
-		memcpy(block_buffer, data + i*BLOCK_SIZE, chunk_size);
-		write_block(block_nums[i], block_buffer);
-		free(block_buffer);
-	}
+/**
+ * The disk is split into block groups, each the blocks one FBV block keeps
+ * track of. A file's blocks go in the same group as its parent directory
+ * when there's room, and otherwise in the nearest group after it that has
+ * room, so listing a directory and then reading its files doesn't send
+ * the disk head all over the place.
+ */
 
-	printf("Created a data file at \'%s\':\nParent block %d, inode # %d, data blocks ",
-			path, parent_block, inode_num);
-	for(int i=0; i<nblocks; i++) {
-		printf("%d ", block_nums[i]);
-	} printf("\n\n");
+int num_groups(llfs_t* fs) {
+
+	return (fs->sb.num_blocks + fs->sb.group_blocks - 1) / fs->sb.group_blocks;
+}
 
-	free(block_nums);
-	for (int i=0; i<5; i++) {
-		free(split_path[i]);
-	} free(split_path);
 
-	commit();
+// The group a block is in
+int block_group(llfs_t* fs, int block_num) {
+
+	return block_num / fs->sb.group_blocks;
 }
 
 
-// Read the data file at the specified path
-// The returned pointer should be freed to avoid memory leaks.
-unsigned char* read_file(char* path) {
+// How many blocks are free in a group
+int group_free_blocks(llfs_t* fs, int group) {
 
-	printf("Reading the file at \'%s\'\n\n", path);
+	int start = group * fs->sb.group_blocks;
+	int end = start + fs->sb.group_blocks;
+	if (end > fs->sb.num_blocks) {
+		end = fs->sb.num_blocks;
+	}
+	return bitmap_count_free_range(&fs->fbv, start, end);
+}
 
-	int inode_num = find_inode_num(path);
 
-	unsigned char* inode_buffer = malloc(INODE_SIZE);
-	read_inode(inode_num, inode_buffer);
+// The group with the most free blocks (the earliest, if there's a tie)
+int emptiest_group(llfs_t* fs) {
 
-	int inode_flags = *(int*)(inode_buffer + 4);
-	if (inode_flags != 1) {
-		printf("The file \'%s\' is not a data file!\n", path);
-		exit(-1);
+	int best = 0;
+	int best_free = -1;
+	for (int g=0; g<num_groups(fs); g++) {
+		int free_blocks = group_free_blocks(fs, g);
+		if (free_blocks > best_free) {
+			best = g;
+			best_free = free_blocks;
+		}
 	}
+	return best;
+}
 
-	// Grab all the file's metadata
-	int file_size = *(int*)inode_buffer;
-	int nblocks = (file_size/(BLOCK_SIZE+1))+1;
-	int* data_blocks = calloc(nblocks, sizeof(int));
-	for (int i=0; i<nblocks; i++) {
-		data_blocks[i] = (int)inode_buffer[(i*2)+8];
-	} 
 
-	unsigned char* data_buffer = calloc(file_size, 1);
-	unsigned char* read_buffer;
-	for (int i=0; i<nblocks; i++) {
-		int block_num = data_blocks[i];
-		read_buffer = calloc(BLOCK_SIZE, 1);
-		read_block(block_num, read_buffer);
-
-		// Find how many bytes we should read from this block
-		int chunk_size;
-		if (i == nblocks-1) {
-			if ((file_size % BLOCK_SIZE) == 0) {
-				chunk_size = BLOCK_SIZE;
-			} else {
-				chunk_size = file_size % BLOCK_SIZE;
-			}
-		} else {
-			chunk_size = BLOCK_SIZE;
+// The smallest free run of count blocks in the goal group, or else in the
+// first group after it (wrapping around) that has one, or else anywhere,
+// straddling groups. Returns -1 if there's no such run.
+int find_run_near(llfs_t* fs, int goal, int count) {
+
+	int ngroups = num_groups(fs);
+	for (int i=0; i<ngroups; i++) {
+		int group = (goal + i) % ngroups;
+		int start = group * fs->sb.group_blocks;
+		int end = start + fs->sb.group_blocks;
+		if (end > fs->sb.num_blocks) {
+			end = fs->sb.num_blocks;
 		}
 
-		memcpy(data_buffer + i*BLOCK_SIZE, read_buffer, chunk_size);
+		int run = bitmap_best_fit(&fs->fbv, count, start, end);
+		if (run >= 0) {
+			return run;
+		}
+	}
 
-		free(read_buffer);
+	if (ngroups == 1) {
+		return -1;
 	}
+	return bitmap_best_fit(&fs->fbv, count, 0, fs->sb.num_blocks);
+}
 
-	free(data_blocks);
-	free(inode_buffer);
 
-	return data_buffer;
+// The group a file's first block is in: for a directory, where its
+// files should go
+int inode_group(llfs_t* fs, int inode_num) {
+
+	struct inode inode;
+	read_inode(fs, inode_num, &inode);
+	return block_group(fs, inode.extents[0].start);
 }
 
 
-// Recursive helper function to delete subfiles, if any exist
-void recursive_delete(int inode_num) {
+// Allocate nblocks blocks in as few extents as possible, near the goal
+// group: the smallest free run that holds them all, or failing that, the
+// longest run there is and then the same again for what's left. Picking
+// the tightest fit keeps big runs whole for big files. Returns how many
+// extents it took, or 0 (with nothing allocated) if it would take more
+// than max_extents.
+// This only touches the in-memory FBV; commit() writes it out.
+int alloc_extents(llfs_t* fs, int goal, int nblocks, struct extent* extents, int max_extents) {
 
-	unsigned char* inode_buffer = malloc(INODE_SIZE);
-	read_inode(inode_num, inode_buffer);
-	int inode_flags = *(int*)(inode_buffer + 4);
+	int count = 0;
+	int remaining = nblocks;
 
-	// If the file is a directory, recursive delete all subfiles
-	if (inode_flags == 0) {
-		char dir_block = *(char*)(inode_buffer + 8);
-		
-		unsigned char* block_buffer = malloc(BLOCK_SIZE);
-		read_block(dir_block, block_buffer);
-
-		for (int i=0; i<BLOCK_SIZE; i+=32) {
-			char inode_byte =  block_buffer[i];
-			if(inode_byte > 0) {
-				recursive_delete(inode_byte);
+	while (remaining > 0 && count < max_extents) {
+		int length = remaining;
+		int start = find_run_near(fs, goal, remaining);
+
+		if (start < 0) {
+			length = bitmap_longest_run(&fs->fbv, &start);
+			if (length == 0) {
+				break;
 			}
 		}
 
-		free(block_buffer);
+		bitmap_mark_range(&fs->fbv, start, start + length);
+		extents[count].start = start;
+		extents[count].length = length;
+		count++;
+		remaining -= length;
 	}
 
-	// For each block used by this file, unmark that block in the FBV
-	for (int i=0; i<10; i++) {
-		short block_num = *(short*)(inode_buffer + (i*2 + 8));
-		unmark_block((int)block_num);
+	if (remaining > 0) {
+		free_extents(fs, extents, count);
+		return 0;
 	}
-
-	// Lastly, delete the inode from our inode storage blocks
-	unsigned char* blank_inode = calloc(32, 1);
-	write_inode(inode_num, blank_inode);
-
-	free(blank_inode);
-	free(inode_buffer);
+	return count;
 }
 
 
-// Delete the specified file, as well as any subfiles
-void delete_file(char* path) {
-
-	begin(path);
-
-	printf("Deleting \'%s\'\n\n", path);
+// List count blocks of the extents in file order, starting at block first
+// (counting from 0)
+void extent_range_blocks(const struct extent* extents, int nextents, int first, int count,
+		int* block_nums) {
 
-	int inode_num = find_inode_num(path);
-	recursive_delete(inode_num);
+	int n = 0;
+	for (int i=0; i<nextents && n < count; i++) {
+		int length = extents[i].length;
+		if (first >= length) {
+			first -= length;
+			continue;
+		}
 
-	// Remove this entry from the parent directory
-	int parent_block = find_parent_block(path);
-	unsigned char* block_buffer = malloc(BLOCK_SIZE);
-	read_block(parent_block, block_buffer);
-
-	unsigned char* blank_entry = calloc(32, 1);
-	for (int i=0; i<BLOCK_SIZE; i+=32) {
-		if (block_buffer[i] == inode_num) {
-			memcpy(block_buffer + i, blank_entry, 32);
-			write_block(parent_block, block_buffer);
-			break;
+		for (int j=first; j<length && n < count; j++) {
+			block_nums[n++] = extents[i].start + j;
 		}
+		first = 0;
 	}
+}
 
-	free(blank_entry);
-	free(block_buffer);
 
-	commit();
-}
+// Read count bytes from offset in a file with the given extents into
+// dest. Whole blocks go straight into dest; only a partial block at
+// either end goes through a bounce buffer.
+void read_extents(llfs_t* fs, const struct extent* extents, int nextents,
+		int offset, int count, unsigned char* dest) {
 
+	int block_size = fs->sb.block_size;
+	unsigned char* bounce = NULL;
+	int block_num;
 
-// Simulate a crash while writing a file at path -- for testing purposes
-void simulate_write_crash(char* path, unsigned char* data, int data_len) {
+	// A head that starts partway into a block
+	if (offset % block_size != 0 && count > 0) {
+		int n = block_size - offset % block_size;
+		if (n > count) {
+			n = count;
+		}
 
-	printf("Simulating a crash while writing a file at %s...\n", path);
+		bounce = malloc(block_size);
+		extent_range_blocks(extents, nextents, offset / block_size, 1, &block_num);
+		fs_read_blocks(fs, ROLE_DATA, &block_num, 1, bounce);
+		memcpy(dest, bounce + offset % block_size, n);
+
+		dest += n;
+		offset += n;
+		count -= n;
+	}
 
-	make_datafile(path, data, data_len);
+	// The whole blocks, one request per extent
+	int nblocks = count / block_size;
+	if (nblocks > 0) {
+		int* block_nums = malloc(sizeof(int) * nblocks);
+		extent_range_blocks(extents, nextents, offset / block_size, nblocks, block_nums);
+		fs_read_blocks(fs, ROLE_DATA, block_nums, nblocks, dest);
+		free(block_nums);
+
+		dest += (size_t)nblocks * block_size;
+		offset += nblocks * block_size;
+		count -= nblocks * block_size;
+	}
 
-	// re-raise the "working" flag that was just lowered by make_datafile()
-	unsigned char* buffer = malloc(BLOCK_SIZE);
-	read_block(2, buffer);
+	// A tail that ends partway into a block
+	if (count > 0) {
+		if (bounce == NULL) {
+			bounce = malloc(block_size);
+		}
+		extent_range_blocks(extents, nextents, offset / block_size, 1, &block_num);
+		fs_read_blocks(fs, ROLE_DATA, &block_num, 1, bounce);
+		memcpy(dest, bounce, count);
+	}
 
-	char one = 1;
-	memcpy(buffer, &one, 1);
-	write_block(2, buffer);
+	free(bounce);
 }
 
 
-// Simulate a crash while deleting a file at path -- for testing purposes
-void simulate_delete_crash(char* path) {
+// Lay count bytes of data at offset over the blocks of a file they cover,
+// where the file held old_size bytes before. Returns a buffer of *nblocks
+// blocks, from block *first of the file on, to be written in one request.
+// A block the write covers part of is read first if it holds old data;
+// anything between old_size and offset is zeroed.
+unsigned char* prepare_write(llfs_t* fs, const struct extent* extents, int nextents, int old_size,
+		int offset, int count, const unsigned char* data, int* first, int* nblocks) {
 
-	printf("Simulating a crash while deleting a file at %s...\n", path);
+	int block_size = fs->sb.block_size;
+	int start = (offset < old_size) ? offset : old_size;
+	int end = offset + count;
 
-	delete_file(path);
+	*first = start / block_size;
+	*nblocks = (end - 1) / block_size - *first + 1;
 
-	// re-raise the "working" flag that was just lowered by delete_file()
-	unsigned char* buffer = malloc(BLOCK_SIZE);
-	read_block(2, buffer);
+	// Past the old end of the file, blocks are all zeros until the data
+	unsigned char* write_buffer = calloc(*nblocks, block_size);
+	int block_num;
+	if (start % block_size != 0) {
+		extent_range_blocks(extents, nextents, *first, 1, &block_num);
+		fs_read_blocks(fs, ROLE_DATA, &block_num, 1, write_buffer);
+	}
+	int last = *first + *nblocks - 1;
+	if (end % block_size != 0 && last * block_size < old_size && (*nblocks > 1 || start % block_size == 0)) {
+		extent_range_blocks(extents, nextents, last, 1, &block_num);
+		fs_read_blocks(fs, ROLE_DATA, &block_num, 1,
+				write_buffer + (size_t)(*nblocks - 1) * block_size);
+	}
 
-	char one = 1;
-	memcpy(buffer, &one, 1);
-	write_block(2, buffer);
+	memset(write_buffer + (start - *first * block_size), 0, offset - start);
+	memcpy(write_buffer + (offset - *first * block_size), data, count);
+	return write_buffer;
 }
 
 
-// Initialize the root directory -- Blocks 4-7 are our inode blocks
-void init_root() {
-
-	// First, allocate the inode
-	unsigned char* buffer = calloc(32, 1);
+// List every block of the extents in file order; returns how many there are
+int extent_blocks(const struct extent* extents, int count, int* block_nums) {
 
-	unsigned int size = 512; // default size of a directory file
-	memcpy(buffer, &size, sizeof(int));
+	int nblocks = 0;
+	for (int i=0; i<count; i++) {
+		for (unsigned int j=0; j<extents[i].length; j++) {
+			block_nums[nblocks++] = extents[i].start + j;
+		}
+	}
+	return nblocks;
+}
 
-	int flags = 0; // indicates root is a directory
-	memcpy(buffer + 4, &flags, sizeof(int));
 
-	// The root directory only uses block 10
-	unsigned short ten = 10;
-	for (int i=0; i<10; i++) {
-		int offset = 8 + (i*2);
-		memcpy(buffer + offset, &ten, sizeof(short));
-	}
+// Where all of a file's blocks are. The first NUM_EXTENTS extents live in
+// the inode. The rest go in map blocks: map_blocks[0] is the indirect
+// block, and if that fills up, map_blocks[1] is the double-indirect block
+// and map_blocks[2...] are the indirect blocks it points to.
+struct file_map {
+	struct extent* extents;
+	int nextents;
+	int* map_blocks;
+	int nmap;
+};
 
-	// Single/double indirect blocks? idk what these fields mean
-	unsigned short zero = 0;
-	memcpy(buffer + 28, &zero, sizeof(short));
-	memcpy(buffer + 30, &zero, sizeof(short));
 
-	write_inode(1, buffer);
-	free(buffer);
+// How many extents fit in one map block
+int extents_per_block(llfs_t* fs) {
 
-	// We know block 10 is zero-initialized, so we'll just mark it as in-use.
-	mark_block(10);
+	return fs->sb.block_size / sizeof(struct extent);
 }
 
 
-// Initialize the free-block vector (block 1)
-void init_fbv() {
+// The most extents a file can have: the inode's own, a full indirect
+// block, and a full indirect block for every pointer in the double-indirect block
+long max_file_extents(llfs_t* fs) {
 
-	unsigned char* buffer = calloc(BLOCK_SIZE, 1);
+	long per_block = extents_per_block(fs);
+	return NUM_EXTENTS + per_block + (fs->sb.block_size / sizeof(int)) * per_block;
+}
 
-	unsigned char b = 0; // Blocks 0-7 are unavailable
-	memcpy(buffer + sizeof(char)*0, &b, sizeof(char));
 
-	b = 0x3f; // Blocks 8-9 are also unavailable
-	memcpy(buffer + sizeof(char)*1, &b, sizeof(char));
+// How many map blocks it takes to hold a file with nextents extents
+int map_blocks_needed(llfs_t* fs, int nextents) {
 
-	// Every other block is available
-	for (int i=2; i<BLOCK_SIZE; i++) {
-		b = 0xff;
-		memcpy(buffer + sizeof(char)*i, &b, sizeof(char));
-	}
+	int per_block = extents_per_block(fs);
+	int spill = nextents - NUM_EXTENTS;
 
-	write_block(1, buffer);
-	free(buffer);
+	if (spill <= 0) return 0;
+	if (spill <= per_block) return 1;
+	return 2 + (spill - per_block + per_block - 1) / per_block;
 }
 
 
-// Initialize the superblock (block 0) with our file system's metadata
-void init_superblock() {
+// The most blocks an operation that changes up to inode_blocks inode
+// blocks, and leaves a file with up to nextents extents, can add to the
+// running transaction. It can change both bitmaps. Adding a name can
+// split a bucket once per bit of depth, each time changing it and a new
+// block, and the file's map blocks come on top of those.
+int op_log_blocks(llfs_t* fs, int inode_blocks, int nextents) {
+
+	return inode_blocks + fs->sb.fbv_blocks + fs->sb.ibm_blocks
+		+ 2 * DIR_MAX_DEPTH + 1 + map_blocks_needed(fs, nextents) + 2;
+}
 
-	unsigned char* buffer = calloc(BLOCK_SIZE, 1);
-	int magic_number = 0xBEEF;
-	int blocks = NUM_BLOCKS;
-	int inodes = NUM_INODES;
 
-	memcpy(buffer + sizeof(int)*0, &magic_number, sizeof(int));
-	memcpy(buffer + sizeof(int)*1, &blocks, sizeof(int));
-	memcpy(buffer + sizeof(int)*2, &inodes, sizeof(int));
+// The most blocks any single operation can add: deleting a tree can
+// change every inode block, and the map blocks of the directory and of a
+// new file between them cover at most every block on the disk
+int max_op_blocks(llfs_t* fs) {
 
-	write_block(0, buffer);
-	free(buffer);
+	return op_log_blocks(fs, fs->sb.inode_blocks, fs->sb.num_blocks);
 }
 
 
-// Initialize the file system
-void init() {
+// Release the memory of a file map (not the blocks in it)
+void destroy_file_map(struct file_map* map) {
 
-	wipe_disk();
-	init_superblock();
-	init_fbv();
-	init_root();
+	free(map->extents);
+	free(map->map_blocks);
+	map->extents = NULL;
+	map->map_blocks = NULL;
 }
-void InitLLFS() { init(); }
 
+
+// Give a file's data and map blocks back to the FBV
+void free_file_blocks(llfs_t* fs, struct file_map* map) {
+
+	free_extents(fs, map->extents, map->nextents);
+	for (int i=0; i<map->nmap; i++) {
+		free_blocks(fs, map->map_blocks[i], map->map_blocks[i] + 1);
+	}
+}
+
+
+// Allocate nblocks blocks for a file near the goal group, plus the map
+// blocks its extents need. Returns 0 (with nothing allocated) if the disk
+// can't hold it. Like alloc_extents(), this only touches the in-memory FBV.
+int alloc_file_blocks(llfs_t* fs, int goal, int nblocks, struct file_map* map) {
+
+	long max_extents = max_file_extents(fs);
+	if (max_extents > nblocks) {
+		max_extents = nblocks;
+	}
+
+	map->extents = calloc(max_extents, sizeof(struct extent));
+	map->nextents = alloc_extents(fs, goal, nblocks, map->extents, (int)max_extents);
+	map->nmap = 0;
+	map->map_blocks = calloc(map_blocks_needed(fs, map->nextents) + 1, sizeof(int));
+
+	if (map->nextents == 0) {
+		destroy_file_map(map);
+		return 0;
+	}
+
+	for (int needed = map_blocks_needed(fs, map->nextents); map->nmap < needed; map->nmap++) {
+		struct extent block;
+		if (alloc_extents(fs, goal, 1, &block, 1) == 0) {
+			free_file_blocks(fs, map);
+			destroy_file_map(map);
+			return 0;
+		}
+		map->map_blocks[map->nmap] = block.start;
+	}
+
+	return 1;
+}
+
+
+// Fill in an inode's extents from a file map, writing out its map blocks
+// (all at once) if the inode doesn't have room for every extent
+void store_file_map(llfs_t* fs, const struct file_map* map, struct inode* inode) {
+
+	int direct = (map->nextents < NUM_EXTENTS) ? map->nextents : NUM_EXTENTS;
+	memset(inode->extents, 0, sizeof(inode->extents));
+	memcpy(inode->extents, map->extents, direct * sizeof(struct extent));
+	inode->indirect = 0;
+	inode->double_indirect = 0;
+
+	if (map->nmap == 0) {
+		return;
+	}
+
+	// Every map block but the double-indirect one gets the next run of
+	// extents; unused slots stay 0
+	int per_block = extents_per_block(fs);
+	unsigned char* buffer = calloc(map->nmap, fs->sb.block_size);
+	unsigned int* pointers = (unsigned int*)(buffer + fs->sb.block_size);
+
+	int next = direct;
+	for (int i=0; i<map->nmap; i++) {
+		if (i == 1) {
+			continue;
+		}
+		if (i >= 2) {
+			pointers[i-2] = map->map_blocks[i];
+		}
+
+		int count = map->nextents - next;
+		if (count > per_block) {
+			count = per_block;
+		}
+		memcpy(buffer + (size_t)i * fs->sb.block_size, map->extents + next,
+				count * sizeof(struct extent));
+		next += count;
+	}
+
+	inode->indirect = map->map_blocks[0];
+	if (map->nmap > 1) {
+		inode->double_indirect = map->map_blocks[1];
+	}
+
+	fs_write_blocks(fs, ROLE_INDIRECT, map->map_blocks, map->nmap, buffer);
+	free(buffer);
+}
+
+
+// Copy the extents out of a block of them, up to the first unused one
+int read_extent_block(llfs_t* fs, const unsigned char* block, struct extent* extents) {
+
+	const struct extent* stored = (const struct extent*)block;
+	int count = 0;
+	while (count < extents_per_block(fs) && stored[count].length > 0) {
+		extents[count] = stored[count];
+		count++;
+	}
+	return count;
+}
+
+
+// Work out where all of a file's blocks are. The map blocks are read in
+// two batches: the indirect and double-indirect blocks together, then
+// every indirect block the double-indirect one points to.
+void load_file_map(llfs_t* fs, const struct inode* inode, struct file_map* map) {
+
+	int per_block = extents_per_block(fs);
+	map->nmap = 0;
+
+	unsigned char* top = NULL;
+	int npointers = 0;
+	if (inode->indirect != 0) {
+		int top_blocks[2] = { inode->indirect, inode->double_indirect };
+		map->nmap = (inode->double_indirect != 0) ? 2 : 1;
+
+		top = malloc((size_t)map->nmap * fs->sb.block_size);
+		fs_read_blocks(fs, ROLE_INDIRECT, top_blocks, map->nmap, top);
+
+		if (map->nmap == 2) {
+			const unsigned int* pointers = (const unsigned int*)(top + fs->sb.block_size);
+			while (npointers < fs->sb.block_size / (int)sizeof(int) && pointers[npointers] != 0) {
+				npointers++;
+			}
+		}
+	}
+
+	map->map_blocks = calloc(map->nmap + npointers + 1, sizeof(int));
+	if (map->nmap > 0) {
+		map->map_blocks[0] = inode->indirect;
+	}
+	if (map->nmap > 1) {
+		map->map_blocks[1] = inode->double_indirect;
+		memcpy(map->map_blocks + 2, top + fs->sb.block_size, npointers * sizeof(int));
+	}
+
+	unsigned char* second = malloc((size_t)npointers * fs->sb.block_size);
+	fs_read_blocks(fs, ROLE_INDIRECT, map->map_blocks + 2, npointers, second);
+	map->nmap += npointers;
+
+	// The inode's own extents come first, then the indirect block's, then
+	// the rest in the order the double-indirect block lists them
+	map->extents = calloc(NUM_EXTENTS + (size_t)(1 + npointers) * per_block, sizeof(struct extent));
+	map->nextents = 0;
+	while (map->nextents < NUM_EXTENTS && inode->extents[map->nextents].length > 0) {
+		map->extents[map->nextents] = inode->extents[map->nextents];
+		map->nextents++;
+	}
+
+	if (top != NULL) {
+		map->nextents += read_extent_block(fs, top, map->extents + map->nextents);
+	}
+	for (int i=0; i<npointers; i++) {
+		map->nextents += read_extent_block(fs, second + (size_t)i * fs->sb.block_size,
+				map->extents + map->nextents);
+	}
+
+	free(second);
+	free(top);
+}
+
+
+// How many blocks a data file of size bytes takes (at least 1)
+int blocks_for_size(llfs_t* fs, int size) {
+
+	int nblocks = (size + fs->sb.block_size - 1) / fs->sb.block_size;
+	return (nblocks == 0) ? 1 : nblocks;
+}
+
+
+// Store a file's extents after they changed. Map blocks are never changed
+// in place: if the file has any, or needs some now, they're all replaced
+// with new ones near the goal group and the old ones freed.
+void replace_file_map(llfs_t* fs, struct file_map* map, struct inode* inode, int goal) {
+
+	int needed = map_blocks_needed(fs, map->nextents);
+	if (map->nmap > 0 || needed > 0) {
+		int* map_blocks = calloc(needed + 1, sizeof(int));
+		for (int i=0; i<needed; i++) {
+			struct extent block;
+			if (alloc_extents(fs, goal, 1, &block, 1) == 0) {
+				printf("The disk is full!\n");
+				exit(-1);
+			}
+			map_blocks[i] = block.start;
+		}
+		for (int i=0; i<map->nmap; i++) {
+			free_blocks(fs, map->map_blocks[i], map->map_blocks[i] + 1);
+		}
+
+		free(map->map_blocks);
+		map->map_blocks = map_blocks;
+		map->nmap = needed;
+	}
+
+	store_file_map(fs, map, inode);
+}
+
+
+// Give a file enough blocks for new_size bytes. New blocks go right
+// after its last one if they're free, so the last extent just gets
+// longer; otherwise they're allocated near it. The map is stored with
+// replace_file_map().
+// The caller makes sure there's room first.
+void grow_file(llfs_t* fs, struct inode* inode, struct file_map* map, int new_size) {
+
+	int extra = blocks_for_size(fs, new_size) - blocks_for_size(fs, inode->size);
+	inode->size = new_size;
+	if (extra <= 0) {
+		return;
+	}
+
+	map->extents = realloc(map->extents, sizeof(struct extent) * (map->nextents + extra));
+	struct extent* last = &map->extents[map->nextents - 1];
+	int end = last->start + last->length;
+	int goal = block_group(fs, end - 1);
+
+	if (end + extra <= fs->sb.num_blocks
+			&& bitmap_count_free_range(&fs->fbv, end, end + extra) == extra) {
+		bitmap_mark_range(&fs->fbv, end, end + extra);
+		last->length += extra;
+	} else {
+		long max_extents = max_file_extents(fs) - map->nextents;
+		if (max_extents > extra) {
+			max_extents = extra;
+		}
+
+		struct extent* added = map->extents + map->nextents;
+		int count = alloc_extents(fs, goal, extra, added, (int)max_extents);
+		if (count == 0) {
+			printf("The disk is full!\n");
+			exit(-1);
+		}
+
+		// A run that starts where the file ends just carries on its last extent
+		if (added[0].start == end) {
+			last->length += added[0].length;
+			memmove(added, added + 1, (count - 1) * sizeof(struct extent));
+			count--;
+		}
+		map->nextents += count;
+	}
+
+	replace_file_map(fs, map, inode, goal);
+}
+
+
+// Move count blocks of a file, from block first of it on, to new blocks
+// near where they were, so a write can go there instead of over data the
+// last commit still points at. The old blocks are freed, and the extents
+// stored again like grow_file() does. The caller makes sure there's room
+// first, and writes the inode.
+void relocate_blocks(llfs_t* fs, struct inode* inode, struct file_map* map, int first, int count) {
+
+	int old_start;
+	extent_range_blocks(map->extents, map->nextents, first, 1, &old_start);
+	int goal = block_group(fs, old_start);
+
+	struct extent* moved = calloc(count, sizeof(struct extent));
+	int nmoved = alloc_extents(fs, goal, count, moved, count);
+	if (nmoved == 0) {
+		printf("The disk is full!\n");
+		exit(-1);
+	}
+
+	// The extents before the range, the new ones, then the ones after it,
+	// splitting the ones it starts and ends in
+	struct extent* extents = calloc(map->nextents + nmoved + 1, sizeof(struct extent));
+	int n = 0;
+	int end = first + count;
+	int pos = 0;	// the file block extent i starts at
+	for (int i=0; i<map->nextents; i++) {
+		struct extent e = map->extents[i];
+		int e_end = pos + e.length;
+
+		if (pos < first) {
+			extents[n].start = e.start;
+			extents[n].length = ((e_end < first) ? e_end : first) - pos;
+			n++;
+		}
+		if (pos < end && e_end > first) {
+			int from = (pos > first) ? pos : first;
+			int to = (e_end < end) ? e_end : end;
+			free_blocks(fs, e.start + (from - pos), e.start + (to - pos));
+			if (pos <= first) {
+				memcpy(extents + n, moved, nmoved * sizeof(struct extent));
+				n += nmoved;
+			}
+		}
+		if (e_end > end) {
+			int from = (pos > end) ? pos : end;
+			extents[n].start = e.start + (from - pos);
+			extents[n].length = e_end - from;
+			n++;
+		}
+		pos = e_end;
+	}
+
+	// New blocks that happen to carry on from their neighbours join them
+	int merged = 0;
+	for (int i=0; i<n; i++) {
+		if (merged > 0 && extents[merged-1].start + extents[merged-1].length == extents[i].start) {
+			extents[merged-1].length += extents[i].length;
+		} else {
+			extents[merged++] = extents[i];
+		}
+	}
+
+	free(moved);
+	free(map->extents);
+	map->extents = extents;
+	map->nextents = merged;
+	replace_file_map(fs, map, inode, goal);
+}
+
+
+// Find the earliest free inode number, or -1 if they're all in use.
+// Inode n is bit n-1 of the inode bitmap. Doesn't take it.
+int find_free_inode(llfs_t* fs) {
+
+	int item = bitmap_find_free(&fs->ibm);
+	return (item < 0) ? -1 : item + 1;
+}
+
+
+// Take the earliest free inode number. Like alloc_extents(), this only
+// touches the in-memory bitmap; commit() writes it out.
+int alloc_inode(llfs_t* fs) {
+
+	int inode_num = find_free_inode(fs);
+	if (inode_num < 0) {
+		printf("Out of inodes! All %d are in use.\n", fs->sb.num_inodes);
+		exit(-1);
+	}
+
+	bitmap_mark(&fs->ibm, inode_num - 1);
+	return inode_num;
+}
+
+
+/**
+ * Paths are never copied or split up into separate strings: a component
+ * is a pointer into the caller's path plus a length. Any number of
+ * slashes separate components, and leading or trailing ones don't count,
+ * so "a//b/" names the same file as "/a/b".
+ */
+
+// One component of a path, pointing into the path string
+struct path_component {
+	const char* name;
+	int len;
+};
+
+
+// Step *cursor over the next component of a path. Returns 0 when there
+// are none left.
+int next_component(const char** cursor, struct path_component* comp) {
+
+	const char* p = *cursor;
+	while (*p == '/') {
+		p++;
+	}
+	if (*p == '\0') {
+		*cursor = p;
+		return 0;
+	}
+
+	comp->name = p;
+	while (*p != '\0' && *p != '/') {
+		p++;
+	}
+	comp->len = p - comp->name;
+
+	*cursor = p;
+	return 1;
+}
+
+
+// Find the last component of a path (the file it names). dir_len is set to
+// the length of what comes before it, minus the slashes: the directory
+// the file is in, which is empty for the root.
+void last_component(const char* path, struct path_component* last, int* dir_len) {
+
+	const char* end = path + strlen(path);
+	while (end > path && end[-1] == '/') {
+		end--;
+	}
+	if (end == path) {
+		printf("The path \'%s\' doesn't name a file!\n", path);
+		exit(-1);
+	}
+
+	const char* start = end;
+	while (start > path && start[-1] != '/') {
+		start--;
+	}
+	last->name = start;
+	last->len = end - start;
+
+	while (start > path && start[-1] == '/') {
+		start--;
+	}
+	*dir_len = start - path;
+}
+
+
+// Whether the first len characters of a path are written the one way the
+// path cache knows them by: "/a/b", with no doubled or trailing slashes
+int is_canonical(const char* path, int len) {
+
+	if (len == 0 || path[0] != '/' || path[len-1] == '/') {
+		return 0;
+	}
+	for (int i=1; i<len; i++) {
+		if (path[i] == '/' && path[i-1] == '/') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+// List every block of a file in order; returns how many there are.
+// The list should be freed.
+int list_file_blocks(llfs_t* fs, const struct inode* inode, int** block_nums) {
+
+	struct file_map map;
+	load_file_map(fs, inode, &map);
+
+	int nblocks = 0;
+	for (int i=0; i<map.nextents; i++) {
+		nblocks += map.extents[i].length;
+	}
+
+	*block_nums = calloc(nblocks + 1, sizeof(int));
+	extent_blocks(map.extents, map.nextents, *block_nums);
+
+	destroy_file_map(&map);
+	return nblocks;
+}
+
+
+/**
+ * Directories are extendible hash tables. A directory's blocks are its
+ * buckets, and the low bits of a name's FNV-1a hash pick the bucket its
+ * entry lives in, so finding, adding or removing an entry only ever looks
+ * at that one block. Each bucket starts with a header saying how many
+ * bits pick it. When a bucket fills up, it alone splits in two.
+ */
+
+// FNV-1a hash of a file name
+unsigned int name_hash(const char* name, int len) {
+
+	unsigned int hash = 2166136261u;
+	for (int i=0; i<len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+// A directory's bucket table: the block of each of its 2^depth hash slots.
+// It's built from the buckets' headers the first time it's needed and
+// kept in fs->dir_tables after that; the pointer is good until the next
+// change to them.
+const int* dir_table(llfs_t* fs, int dir_inode_num, const struct inode* dir, int* depth) {
+
+	const int* table = dindex_get(fs->dir_tables, dir_inode_num, depth);
+	if (table != NULL) {
+		return table;
+	}
+
+	int* blocks;
+	int nblocks = list_file_blocks(fs, dir, &blocks);
+
+	// A bucket of depth d takes every 2^d-th slot, starting at its bits.
+	// A directory that's never split is one bucket of depth 0.
+	int max_depth = 0;
+	int* slots = blocks;
+	if (nblocks > 1) {
+		unsigned char* data = malloc((size_t)nblocks * fs->sb.block_size);
+		fs_read_blocks(fs, ROLE_DIRECTORY, blocks, nblocks, data);
+
+		for (int i=0; i<nblocks; i++) {
+			const struct bucket_header* header =
+				(const struct bucket_header*)(data + (size_t)i * fs->sb.block_size);
+			if ((int)header->depth > max_depth) {
+				max_depth = header->depth;
+			}
+		}
+
+		slots = malloc(sizeof(int) << max_depth);
+		for (int i=0; i<nblocks; i++) {
+			const struct bucket_header* header =
+				(const struct bucket_header*)(data + (size_t)i * fs->sb.block_size);
+			for (long slot = header->bits; slot < (1L << max_depth); slot += 1L << header->depth) {
+				slots[slot] = blocks[i];
+			}
+		}
+		free(data);
+	}
+
+	dindex_put(fs->dir_tables, dir_inode_num, max_depth, slots);
+	if (slots != blocks) {
+		free(slots);
+	}
+	free(blocks);
+	return dindex_get(fs->dir_tables, dir_inode_num, depth);
+}
+
+
+// The block of a directory that a name belongs in
+int dir_bucket(llfs_t* fs, int dir_inode_num, const struct inode* dir, const char* name, int len) {
+
+	int depth;
+	const int* table = dir_table(fs, dir_inode_num, dir, &depth);
+	return table[name_hash(name, len) & ((1u << depth) - 1)];
+}
+
+
+// Look a name up in a directory. Returns the child's inode number, or 0 if
+// there's no such entry. If block and entry_num aren't NULL, they're set to
+// where the entry is, or otherwise to the name's bucket and its first free
+// entry (-1 if it's full). A name too long to store is never found.
+int dir_lookup(llfs_t* fs, int dir_inode_num, const struct inode* dir, const char* name, int len,
+		int* block, int* entry_num) {
+
+	int bucket = dir_bucket(fs, dir_inode_num, dir, name, len);
+	const unsigned char* block_buffer = fs_peek_block(fs, bucket);
+
+	int free_entry = -1;
+	int child_inode = 0;
+	int i = 1; // past the bucket's header
+
+	for ( ; i<fs->sb.block_size/DIR_ENTRY_SIZE; i++) {
+		const unsigned char* entry = block_buffer + i*DIR_ENTRY_SIZE;
+		unsigned int entry_inode = *(const unsigned int*)entry;
+
+		if (entry_inode == 0) {
+			if (free_entry == -1) {
+				free_entry = i;
+			}
+		} else if (len <= DIR_NAME_MAX && memcmp(entry + 4, name, len) == 0 && entry[4 + len] == '\0') {
+			child_inode = entry_inode;
+			break;
+		}
+	}
+
+	if (block != NULL) {
+		*block = bucket;
+	}
+	if (entry_num != NULL) {
+		*entry_num = child_inode ? i : free_entry;
+	}
+	return child_inode;
+}
+
+
+// Split the full bucket a name belongs in. It takes one more bit of the
+// hash, and the entries with that bit set move to a new bucket added to
+// the end of the directory, so only those two blocks and the directory's
+// inode (and map blocks, if it has any) change. Slots of the bucket table
+// that pointed at the old bucket and have the bit set point at the new
+// one; if the old bucket was as deep as the table, the table doubles first.
+void dir_split(llfs_t* fs, int dir_inode_num, struct inode* dir, const char* name, int len) {
+
+	unsigned int hash = name_hash(name, len);
+	int table_depth;
+	const int* table = dir_table(fs, dir_inode_num, dir, &table_depth);
+	int bucket = table[hash & ((1u << table_depth) - 1)];
+
+	unsigned char* old_data = malloc(fs->sb.block_size);
+	fs_read_block(fs, bucket, old_data);
+	struct bucket_header* header = (struct bucket_header*)old_data;
+	int depth = header->depth;
+
+	// Another bit only helps if some entry's hash differs from the name's.
+	// The depth limit keeps the table (and how often this can run) bounded.
+	int entries_per_block = fs->sb.block_size / DIR_ENTRY_SIZE;
+	int separable = 0;
+	for (int i=1; i<entries_per_block; i++) {
+		const char* entry_name = (const char*)old_data + i*DIR_ENTRY_SIZE + 4;
+		separable |= (name_hash(entry_name, strlen(entry_name)) != hash);
+	}
+	if (!separable || depth >= DIR_MAX_DEPTH) {
+		printf("There's no room for '%.*s' in its directory! Too many names there hash alike.\n",
+				len, name);
+		exit(-1);
+	}
+
+	int new_depth = (depth + 1 > table_depth) ? depth + 1 : table_depth;
+	int* slots = malloc(sizeof(int) << new_depth);
+	for (long i=0; i<(1L << new_depth); i++) {
+		slots[i] = table[i & ((1L << table_depth) - 1)];
+	}
+
+	// The new bucket goes in a block added to the end of the directory
+	struct file_map map;
+	load_file_map(fs, dir, &map);
+	grow_file(fs, dir, &map, dir->size + fs->sb.block_size);
+	int new_bucket = map.extents[map.nextents - 1].start + map.extents[map.nextents - 1].length - 1;
+	destroy_file_map(&map);
+	write_inode(fs, dir_inode_num, dir);
+
+	unsigned char* new_data = calloc(1, fs->sb.block_size);
+	struct bucket_header* new_header = (struct bucket_header*)new_data;
+	header->depth = depth + 1;
+	new_header->depth = depth + 1;
+	new_header->bits = header->bits | (1u << depth);
+
+	int moved = 1;
+	for (int i=1; i<entries_per_block; i++) {
+		unsigned char* entry = old_data + i*DIR_ENTRY_SIZE;
+		if (name_hash((const char*)entry + 4, strlen((const char*)entry + 4)) & (1u << depth)) {
+			memcpy(new_data + moved*DIR_ENTRY_SIZE, entry, DIR_ENTRY_SIZE);
+			memset(entry, 0, DIR_ENTRY_SIZE);
+			moved++;
+		}
+	}
+
+	fs_write_block(fs, bucket, old_data);
+	fs_write_block(fs, new_bucket, new_data);
+
+	for (long i=new_header->bits; i<(1L << new_depth); i+=1L << (depth + 1)) {
+		slots[i] = new_bucket;
+	}
+	dindex_put(fs->dir_tables, dir_inode_num, new_depth, slots);
+
+	free(slots);
+	free(new_data);
+	free(old_data);
+}
+
+
+// Add an entry for a child file to a directory, splitting the name's
+// bucket until it has room. Returns the block the entry went in.
+int write_entry_to_parent(llfs_t* fs, int child_inode, const char* child_fn, int len, int parent_inode) {
+
+	if (len > DIR_NAME_MAX) {
+		printf("The name '%.*s' is too long! Names can be up to %d characters.\n",
+				len, child_fn, DIR_NAME_MAX);
+		exit(-1);
+	}
+
+	struct inode dir;
+	read_inode(fs, parent_inode, &dir);
+
+	int parent_block, entry_num;
+	dir_lookup(fs, parent_inode, &dir, child_fn, len, &parent_block, &entry_num);
+	while (entry_num == -1) {
+		dir_split(fs, parent_inode, &dir, child_fn, len);
+		dir_lookup(fs, parent_inode, &dir, child_fn, len, &parent_block, &entry_num);
+	}
+
+	// Construct the entry in the parent block
+	unsigned char* buffer = malloc(sizeof(char) * fs->sb.block_size);
+	fs_read_block(fs, parent_block, buffer);
+
+	unsigned char* entry = buffer + (entry_num * DIR_ENTRY_SIZE);
+	unsigned int child_inode_num = child_inode;
+	memset(entry, 0, DIR_ENTRY_SIZE);
+	memcpy(entry, &child_inode_num, sizeof(int));
+	memcpy(entry + 4, child_fn, len);
+
+	// Write the block back onto the disk
+	fs_write_block(fs, parent_block, buffer);
+	free(buffer);
+
+	dcache_put(fs->dentries, parent_inode, child_fn, len, child_inode);
+	return parent_block;
+}
+
+
+// Remove a child's entry from a directory
+void remove_entry_from_parent(llfs_t* fs, const char* child_fn, int len, int parent_inode) {
+
+	dcache_forget(fs->dentries, parent_inode, child_fn, len);
+
+	struct inode dir;
+	read_inode(fs, parent_inode, &dir);
+
+	int parent_block, entry_num;
+	if (dir_lookup(fs, parent_inode, &dir, child_fn, len, &parent_block, &entry_num) == 0) {
+		return;
+	}
+
+	unsigned char* buffer = malloc(fs->sb.block_size);
+	fs_read_block(fs, parent_block, buffer);
+	memset(buffer + entry_num*DIR_ENTRY_SIZE, 0, DIR_ENTRY_SIZE);
+	fs_write_block(fs, parent_block, buffer);
+	free(buffer);
+}
+
+
+// The inode a name refers to in a directory, or 0 if there's no such file
+int lookup_child(llfs_t* fs, int dir_inode_num, const char* name, int len) {
+
+	int inode_num = dcache_get(fs->dentries, dir_inode_num, name, len);
+	if (inode_num == 0) {
+		struct inode dir;
+		read_inode(fs, dir_inode_num, &dir);
+
+		inode_num = dir_lookup(fs, dir_inode_num, &dir, name, len, NULL, NULL);
+		if (inode_num > 0) {
+			dcache_put(fs->dentries, dir_inode_num, name, len, inode_num);
+		}
+	}
+	return inode_num;
+}
+
+
+// Traverse the directory tree to find the inode of the direct parent
+// directory. Directories we've walked through before come straight out
+// of the path cache, and the rest of the walk goes through the dentry cache.
+int find_parent_inode(llfs_t* fs, const char* path) {
+
+	struct path_component last;
+	int dir_len;
+	last_component(path, &last, &dir_len);
+
+	if (dir_len == 0) {
+		return 1; // root is always inode 1
+	}
+
+	// Only paths written the canonical way are cached, so that deleting a
+	// directory can find everything cached under it
+	int cacheable = is_canonical(path, dir_len);
+	int current_inode = cacheable ? dcache_get(fs->paths, 0, path, dir_len) : 0;
+	if (current_inode > 0) {
+		return current_inode;
+	}
+
+	current_inode = 1; // tree traversal always starts at the root
+	struct inode inode;
+
+	// Traverse until we've hit the goal parent directory
+	const char* cursor = path;
+	struct path_component comp;
+	while (next_component(&cursor, &comp) && comp.name != last.name) {
+		current_inode = lookup_child(fs, current_inode, comp.name, comp.len);
+		if (current_inode == 0) {
+			printf("The file \'%.*s\' does not exist!\n", comp.len, comp.name);
+			exit(-1);
+		}
+
+		read_inode(fs, current_inode, &inode);
+		if (inode.flags != 0) {
+			printf("The file \'%.*s\' is not a directory!\n", comp.len, comp.name);
+			exit(-1);
+		}
+	}
+
+	if (cacheable) {
+		dcache_put(fs->paths, 0, path, dir_len, current_inode);
+	}
+	return current_inode;
+}
+
+
+// Find the inode of the file at the end of the given path
+int find_inode_num(llfs_t* fs, const char* path) {
+
+	struct path_component name;
+	int dir_len;
+	last_component(path, &name, &dir_len);
+
+	// Look the file up in its parent
+	int inode_num = lookup_child(fs, find_parent_inode(fs, path), name.name, name.len);
+	if (inode_num == 0) {
+		printf("The file \'%.*s\' does not exist!\n", name.len, name.name);
+		exit(-1);
+	}
+
+	return inode_num;
+}
+
+
+// Find the data file at path and read its inode. It's an error if the
+// file is a directory.
+int find_data_inode(llfs_t* fs, const char* path, struct inode* inode) {
+
+	int inode_num = find_inode_num(fs, path);
+	read_inode(fs, inode_num, inode);
+
+	if (inode->flags != 1) {
+		printf("The file \'%s\' is not a data file!\n", path);
+		exit(-1);
+	}
+	return inode_num;
+}
+
+
+/**
+ * Open files. llfs_open() resolves a path once and keeps what it found
+ * in the open-file table: the inode number, the size and every extent of
+ * the file. Reads and writes through the handle work out which blocks
+ * they cover from those extents, so they never walk a path and only
+ * touch the data blocks they need. Handles are numbered like POSIX file
+ * descriptors, lowest free number first.
+ */
+
+// Load an open file's size and extents from its inode
+void load_open_file(llfs_t* fs, struct open_file* f) {
+
+	struct inode inode;
+	read_inode(fs, f->inode_num, &inode);
+
+	free(f->extents);
+	f->extents = NULL;
+	f->nextents = 0;
+
+	if (inode.flags != 1) { // deleted (or replaced) behind our back
+		f->stale = 1;
+		return;
+	}
+
+	struct file_map map;
+	load_file_map(fs, &inode, &map);
+	f->size = inode.size;
+	f->extents = map.extents;
+	f->nextents = map.nextents;
+	free(map.map_blocks);
+}
+
+
+// Load the size and extents again for every file open on inode_num (or
+// every open file, if inode_num is 0), after something changed them
+void reload_open_files(llfs_t* fs, int inode_num) {
+
+	for (int fd=0; fd<fs->nfiles; fd++) {
+		struct open_file* f = &fs->files[fd];
+		if (f->in_use && !f->stale && (inode_num == 0 || f->inode_num == inode_num)) {
+			load_open_file(fs, f);
+		}
+	}
+}
+
+
+// The open file behind a handle. Using a handle that isn't open, or whose
+// file has been deleted, is an error.
+struct open_file* get_open_file(llfs_t* fs, int fd) {
+
+	if (fd < 0 || fd >= fs->nfiles || !fs->files[fd].in_use) {
+		printf("%d isn't an open file!\n", fd);
+		exit(-1);
+	}
+	if (fs->files[fd].stale) {
+		printf("The file open as %d has been deleted!\n", fd);
+		exit(-1);
+	}
+	return &fs->files[fd];
+}
+
+
+// Open the data file at path. Returns a handle for the calls below.
+int llfs_open(llfs_t* fs, char* path) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+	stats_op_begin(&fs->stats, OP_OPEN);
+
+	struct inode inode;
+	int inode_num = find_data_inode(fs, path, &inode);
+
+	int fd = 0;
+	while (fd < fs->nfiles && fs->files[fd].in_use) {
+		fd++;
+	}
+	if (fd == fs->nfiles) {
+		int nfiles = (fs->nfiles == 0) ? 8 : fs->nfiles * 2;
+		fs->files = realloc(fs->files, sizeof(struct open_file) * nfiles);
+		memset(fs->files + fs->nfiles, 0, sizeof(struct open_file) * (nfiles - fs->nfiles));
+		fs->nfiles = nfiles;
+	}
+
+	struct open_file* f = &fs->files[fd];
+	memset(f, 0, sizeof(struct open_file));
+	f->in_use = 1;
+	f->inode_num = inode_num;
+	f->path = malloc(strlen(path) + 1);
+	strcpy(f->path, path);
+	load_open_file(fs, f);
+
+	stats_op_end(&fs->stats);
+	return fd;
+}
+
+
+void llfs_close(llfs_t* fs, int fd) {
+
+	if (fd < 0 || fd >= fs->nfiles || !fs->files[fd].in_use) {
+		printf("%d isn't an open file!\n", fd);
+		exit(-1);
+	}
+	free(fs->files[fd].extents);
+	free(fs->files[fd].path);
+	memset(&fs->files[fd], 0, sizeof(struct open_file));
+}
+
+
+// Read up to count bytes from offset in an open file. Returns how many
+// were read, which is fewer than count at the end of the file.
+int llfs_pread(llfs_t* fs, int fd, void* buffer, int count, int offset) {
+
+	struct open_file* f = get_open_file(fs, fd);
+	if (offset < 0 || count <= 0 || offset >= f->size) {
+		return 0;
+	}
+	if (count > f->size - offset) {
+		count = f->size - offset;
+	}
+
+	// Only the blocks the range covers, straight into the caller's buffer
+	stats_op_begin(&fs->stats, OP_PREAD);
+	read_extents(fs, f->extents, f->nextents, offset, count, buffer);
+	stats_op_end(&fs->stats);
+	return count;
+}
+
+
+// Like llfs_pread(), but filling each of iovcnt buffers in turn. Returns
+// the total number of bytes read.
+int llfs_preadv(llfs_t* fs, int fd, const struct iovec* iov, int iovcnt, int offset) {
+
+	int total = 0;
+	for (int i=0; i<iovcnt; i++) {
+		int n = llfs_pread(fs, fd, iov[i].iov_base, iov[i].iov_len, offset + total);
+		total += n;
+		if (n < (int)iov[i].iov_len) {
+			break;
+		}
+	}
+	return total;
+}
+
+
+// Read from an open file's current offset, and move past what was read
+int llfs_read(llfs_t* fs, int fd, void* buffer, int count) {
+
+	int n = llfs_pread(fs, fd, buffer, count, get_open_file(fs, fd)->offset);
+	fs->files[fd].offset += n;
+	return n;
+}
+
+
+// Move an open file's offset, like lseek(2): whence is SEEK_SET, SEEK_CUR
+// or SEEK_END. Returns the new offset.
+int llfs_seek(llfs_t* fs, int fd, int offset, int whence) {
+
+	struct open_file* f = get_open_file(fs, fd);
+
+	if (whence == SEEK_CUR) {
+		offset += f->offset;
+	} else if (whence == SEEK_END) {
+		offset += f->size;
+	}
+	if (offset < 0) {
+		printf("Can't seek to %d, before the start of the file!\n", offset);
+		exit(-1);
+	}
+
+	f->offset = offset;
+	return offset;
+}
+
+
+// If the file system crashed, bring it back to the last transaction that
+// committed: mounting it again replays the journal. An open transaction
+// is rolled back, as a crash would.
+void sys_recover(llfs_t* fs) {
+
+	stats_op_begin(&fs->stats, OP_RECOVER);
+	printf("Recovering disk state...\n\n");
+
+	if (fs->in_transaction) {
+		crash(fs);
+	}
+	mount_fs(fs);
+
+	// Open files may have changed
+	reload_open_files(fs, 0);
+
+	stats_op_end(&fs->stats);
+}
+
+
+// Whether the log has room for the running transaction plus an operation
+// that adds up to op_blocks blocks to it
+int room_for_op(llfs_t* fs, int op_blocks) {
+
+	return transaction_log_blocks(fs, jtxn_count(fs->running) + op_blocks) <= log_blocks(fs);
+}
+
+
+// Whether an operation that changes up to inode_blocks inode blocks, and
+// leaves a file with up to nextents extents, fits in the open transaction.
+// The inodes changed so far go into their blocks first, so each block
+// counts once however many of its inodes changed.
+int transaction_fits(llfs_t* fs, int inode_blocks, int nextents) {
+
+	if (!fs->in_transaction) {
+		return 1;
+	}
+	write_back_inodes(fs);
+	return room_for_op(fs, op_log_blocks(fs, inode_blocks, nextents));
+}
+
+
+// Refuse an operation on path that might not fit in the open transaction.
+// This comes before the operation changes anything, so the transaction
+// can still be committed.
+void check_transaction_room(llfs_t* fs, const char* path, int inode_blocks, int nextents) {
+
+	if (!transaction_fits(fs, inode_blocks, nextents)) {
+		printf("The transaction is full! There's no room in it for '%s'.\n", path);
+		exit(-1);
+	}
+}
+
+
+// Finish a disk-modifying operation. Its changes have joined the running
+// transaction, which commits once group_commit operations have (or once
+// the next operation might not fit in the log with it); in a transaction,
+// llfs_commit_transaction() commits it instead.
+void commit(llfs_t* fs) {
+
+	if (fs->in_transaction) {
+		return;
+	}
+
+	fs->group_ops++;
+	if (fs->group_ops >= fs->group_commit || !room_for_op(fs, max_op_blocks(fs))) {
+		journal_commit(fs);
+	}
+}
+
+
+// Commit the running transaction after this many operations, instead of
+// after each one. A crash loses the operations since the last commit, but
+// each one stays whole, and a block they all change is only logged once.
+void llfs_set_group_commit(llfs_t* fs, int nops) {
+
+	mount_fs(fs);
+	fs->group_commit = (nops < 1) ? 1 : nops;
+	if (fs->group_ops >= fs->group_commit && !fs->in_transaction) {
+		journal_commit(fs);
+	}
+}
+
+
+// Make everything done so far durable and send it all home, so the
+// journal is empty
+void llfs_sync(llfs_t* fs) {
+
+	mount_fs(fs);
+	if (fs->in_transaction) {
+		llfs_commit_transaction(fs);
+	}
+	llfs_flush(fs);
+	journal_commit(fs);
+	checkpoint(fs);
+}
+
+
+/**
+ * Transactions. Every operation between llfs_begin_transaction() and
+ * llfs_commit_transaction() joins the same journal transaction, which
+ * commits once at the end however many blocks they change, so either all
+ * of them happen or, after a crash, none of them do.
+ */
+
+// Start a transaction. Transactions don't nest.
+void llfs_begin_transaction(llfs_t* fs) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+
+	if (fs->in_transaction) {
+		printf("A transaction is already open!\n");
+		exit(-1);
+	}
+
+	// Operations from before it don't go down with it
+	stats_op_begin(&fs->stats, OP_BEGIN);
+	journal_commit(fs);
+	fs->in_transaction = 1;
+	stats_op_end(&fs->stats);
+}
+
+
+// Whether making one more directory, or a file that fits in one run of
+// blocks, is sure to fit in the open transaction. Operations that might
+// not fit are refused until the transaction is committed.
+int llfs_transaction_has_room(llfs_t* fs) {
+
+	mount_fs(fs);
+	return transaction_fits(fs, 2, 1);
+}
+
+
+// Commit every operation since llfs_begin_transaction() at once
+void llfs_commit_transaction(llfs_t* fs) {
+
+	if (!fs->in_transaction) {
+		printf("There's no transaction to commit!\n");
+		exit(-1);
+	}
+
+	llfs_flush(fs);
+	stats_op_begin(&fs->stats, OP_COMMIT);
+
+	fs->in_transaction = 0;
+	int count = journal_commit(fs);
+	printf("Committed a transaction that logged %d blocks\n\n", count);
+
+	stats_op_end(&fs->stats);
+}
+
+
+// Make a directory file at the given path
+void make_dir(llfs_t* fs, char* path) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+
+	if (find_free_inode(fs) < 0) {
+		printf("There's no inode left for '%s'!\n", path);
+		exit(-1);
+	}
+	check_transaction_room(fs, path, 2, 1);
+
+	stats_op_begin(&fs->stats, OP_MAKE_DIR);
+
+	// The new file's name is the last part of the path
+	struct path_component name;
+	int dir_len;
+	last_component(path, &name, &dir_len);
+
+	// Next, we need to traverse the tree to find where to make the new directory
+	int parent_inode = find_parent_inode(fs, path);
+
+	// Find some free space to write our new directory to. Directories in
+	// the root are spread out over the groups, so each top-level tree has
+	// room to grow; deeper ones stay near their parent.
+	int goal = (parent_inode == 1) ? emptiest_group(fs) : inode_group(fs, parent_inode);
+	int inode_num = alloc_inode(fs);
+	struct extent dir_extent;
+	if (alloc_extents(fs, goal, 1, &dir_extent, 1) == 0) {
+		printf("The disk is full!\n");
+		exit(-1);
+	}
+	int block_num = dir_extent.start;
+
+	// Write an entry in the parent directory's block
+	int parent_block = write_entry_to_parent(fs, inode_num, name.name, name.len, parent_inode);
+
+	// Construct an inode for the new directory
+	struct inode inode = {0};
+	inode.size = fs->sb.block_size;
+	inode.flags = 0; // indicates this file is a directory
+
+	// A new directory starts out as a single bucket.
+	// The other extents stay 0, meaning "unused".
+	inode.extents[0] = dir_extent;
+
+	write_inode(fs, inode_num, &inode);
+
+	// Veryify that the directory's block on disk is zero-initialized
+	unsigned char* zbuffer = calloc(fs->sb.block_size, 1);
+	fs_write_block(fs, block_num, zbuffer);
+	free(zbuffer);
+
+	printf("Created a directory at \'%s\':\nParent block %d, inode # %d, storage block %d\n\n",
+			path, parent_block, inode_num, block_num);
+
+	commit(fs);
+	stats_op_end(&fs->stats);
+}
+
+
+
+
+
+// Make a data file at path. If start is -1, blocks are allocated for the
+// data and it's written out; otherwise the data is already on disk in the
+// free blocks from start on, and the file just takes them.
+void create_datafile(llfs_t* fs, char* path, unsigned char* data, int data_size, int start) {
+
+	int nblocks = blocks_for_size(fs, data_size);
+
+	// The data goes in the parent directory's group if it fits there
+	int parent_inode = find_parent_inode(fs, path);
+	int goal = inode_group(fs, parent_inode);
+
+	// Make sure there's room before starting anything we'd have to undo
+	struct file_map map;
+	if (start < 0) {
+		if (alloc_file_blocks(fs, goal, nblocks, &map) == 0) {
+			printf("There's no room for \'%s\'! It needs %d blocks.\n", path, nblocks);
+			exit(-1);
+		}
+		free_file_blocks(fs, &map);
+		destroy_file_map(&map);
+	}
+
+	if (find_free_inode(fs) < 0) {
+		printf("There's no inode left for '%s'!\n", path);
+		exit(-1);
+	}
+	check_transaction_room(fs, path, 2, nblocks);
+
+	stats_op_begin(&fs->stats, OP_MAKE_DATAFILE);
+
+	// The new file's name is the last part of the path
+	struct path_component name;
+	int dir_len;
+	last_component(path, &name, &dir_len);
+
+	// Figure out which blocks we'll use to store the data. This has to come
+	// before the entry, which could free blocks if the directory grows.
+	if (start < 0) {
+		alloc_file_blocks(fs, goal, nblocks, &map);
+	} else {
+		bitmap_mark_range(&fs->fbv, start, start + nblocks);
+		map.extents = calloc(1, sizeof(struct extent));
+		map.extents[0].start = start;
+		map.extents[0].length = nblocks;
+		map.nextents = 1;
+		map.map_blocks = calloc(1, sizeof(int));
+		map.nmap = 0;
+	}
+	int* block_nums = calloc(nblocks, sizeof(int));
+	extent_blocks(map.extents, map.nextents, block_nums);
+
+	// Set up the file's metadata
+	int inode_num = alloc_inode(fs);
+	int parent_block = write_entry_to_parent(fs, inode_num, name.name, name.len, parent_inode);
+
+	// Construct an inode for the new data file
+	struct inode inode = {0};
+	inode.size = data_size;
+	inode.flags = 1; // indicates this file is a data file
+
+	// Where the data lives; unused extents stay 0
+	store_file_map(fs, &map, &inode);
+	destroy_file_map(&map);
+
+	write_inode(fs, inode_num, &inode);
+
+	// Write the actual data to the disk, all blocks in one go; each extent
+	// is a single write. The last block is zero-padded past the end of the data.
+	if (start < 0) {
+		unsigned char* block_buffer = calloc(nblocks, fs->sb.block_size);
+		memcpy(block_buffer, data, data_size);
+		fs_write_blocks(fs, ROLE_DATA, block_nums, nblocks, block_buffer);
+		free(block_buffer);
+	}
+
+	printf("Created a data file at \'%s\':\nParent block %d, inode # %d, data blocks ",
+			path, parent_block, inode_num);
+	for(int i=0; i<nblocks; i++) {
+		printf("%d ", block_nums[i]);
+	} printf("\n\n");
+
+	free(block_nums);
+
+	commit(fs);
+	stats_op_end(&fs->stats);
+}
+
+
+/**
+ * Delayed allocation: while it's on, make_datafile() only copies the
+ * file's path and data into memory. Nothing is allocated or written until
+ * llfs_flush(), which any other operation (and unmounting) does first, or
+ * until MAX_PENDING_BYTES of data are waiting. Then the waiting files are
+ * packed one after another into a single run of free blocks, and all
+ * their data goes out in one write before each file gets its entry and
+ * inode. Data that hasn't been flushed is lost in a crash.
+ */
+
+// Turn delayed allocation on or off. Turning it off flushes.
+void llfs_set_delayed_alloc(llfs_t* fs, int enabled) {
+
+	if (!enabled) {
+		llfs_flush(fs);
+	}
+	fs->delayed_alloc = enabled;
+}
+
+
+// Hold on to a data file until the next flush
+void delay_datafile(llfs_t* fs, char* path, unsigned char* data, int data_size) {
+
+	// Catch a missing directory now rather than at flush time
+	int goal = inode_group(fs, find_parent_inode(fs, path));
+	int nblocks = blocks_for_size(fs, data_size);
+
+	// Never hold back more than the disk can take. If this file can't fit
+	// even on its own, making it now gets the usual error.
+	int fits = bitmap_count_free(&fs->fbv) >= fs->pending_blocks + nblocks
+			&& bitmap_count_free(&fs->ibm) > fs->npending;
+	if (!fits || fs->pending_bytes + data_size > MAX_PENDING_BYTES) {
+		llfs_flush(fs);
+	}
+	if (!fits) {
+		create_datafile(fs, path, data, data_size, -1);
+		return;
+	}
+
+	fs->pending = realloc(fs->pending, sizeof(struct pending_file) * (fs->npending + 1));
+	struct pending_file* p = &fs->pending[fs->npending++];
+	p->path = malloc(strlen(path) + 1);
+	strcpy(p->path, path);
+	p->data = malloc(data_size > 0 ? data_size : 1);
+	memcpy(p->data, data, data_size);
+	p->size = data_size;
+	p->nblocks = nblocks;
+	p->goal = goal;
+
+	fs->pending_blocks += nblocks;
+	fs->pending_bytes += data_size;
+}
+
+
+// Make every waiting data file. Files whose parents are in the same group
+// are packed into one run of blocks near it, and written in a single
+// request per run; then each file is made in its own transaction. If a
+// directory growing along the way takes blocks meant for a later file,
+// the rest get a new run.
+void llfs_flush(llfs_t* fs) {
+
+	if (fs->npending == 0) {
+		return;
+	}
+
+	mount_fs(fs);
+	stats_op_begin(&fs->stats, OP_FLUSH);
+
+	int done = 0;
+	while (done < fs->npending) {
+		int goal = fs->pending[done].goal;
+		int end = done;
+		int total = 0;
+		for ( ; end < fs->npending && fs->pending[end].goal == goal; end++) {
+			total += fs->pending[end].nblocks;
+		}
+
+		int start = find_run_near(fs, goal, total);
+		if (start < 0) {
+			// No run is big enough for them all: this one goes the usual way
+			struct pending_file* p = &fs->pending[done++];
+			create_datafile(fs, p->path, p->data, p->size, -1);
+			continue;
+		}
+
+		// Lay the files out back to back, each zero-padded to whole blocks,
+		// and write them all at once. The blocks are still free on disk,
+		// so nothing points at them until the files are made.
+		unsigned char* run_data = calloc(total, fs->sb.block_size);
+		int* run_blocks = malloc(sizeof(int) * total);
+		int offset = 0;
+		for (int i=done; i<end; i++) {
+			memcpy(run_data + (size_t)offset * fs->sb.block_size, fs->pending[i].data, fs->pending[i].size);
+			offset += fs->pending[i].nblocks;
+		}
+		for (int i=0; i<total; i++) {
+			run_blocks[i] = start + i;
+		}
+		fs_write_blocks(fs, ROLE_DATA, run_blocks, total, run_data);
+		free(run_blocks);
+		free(run_data);
+
+		int next = start;
+		for ( ; done < end; done++) {
+			struct pending_file* p = &fs->pending[done];
+			if (bitmap_count_free_range(&fs->fbv, next, next + p->nblocks) < p->nblocks) {
+				break;
+			}
+			create_datafile(fs, p->path, p->data, p->size, next);
+			next += p->nblocks;
+		}
+	}
+
+	discard_pending(fs);
+	stats_op_end(&fs->stats);
+}
+
+
+/**
+ * Make a data file at the given path, provided some data and its size.
+ * If you pass an inaccurate data size, you're going to get garbage
+ * in the data blocks. So don't do that. Please.
+ */
+void make_datafile(llfs_t* fs, char* path, unsigned char* data, int data_size) {
+
+	mount_fs(fs);
+
+	if (fs->delayed_alloc) {
+		delay_datafile(fs, path, data, data_size);
+	} else {
+		create_datafile(fs, path, data, data_size, -1);
+	}
+}
+
+
+// Find the data file at path for reading, and print that we're reading it
+int find_data_file(llfs_t* fs, char* path, struct inode* inode) {
+
+	printf("Reading the file at \'%s\'\n\n", path);
+	return find_data_inode(fs, path, inode);
+}
+
+
+// Read the first size bytes of a file into buffer: every whole block
+// straight into it, in one read per extent
+void read_inode_data(llfs_t* fs, const struct inode* inode, unsigned char* buffer, int size) {
+
+	struct file_map map;
+	load_file_map(fs, inode, &map);
+	read_extents(fs, map.extents, map.nextents, 0, size, buffer);
+	destroy_file_map(&map);
+}
+
+
+// Read the data file at the specified path
+// The returned pointer should be freed to avoid memory leaks.
+unsigned char* read_file(llfs_t* fs, char* path) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+	stats_op_begin(&fs->stats, OP_READ_FILE);
+
+	struct inode inode;
+	find_data_file(fs, path, &inode);
+
+	unsigned char* data_buffer = malloc(inode.size > 0 ? inode.size : 1);
+	read_inode_data(fs, &inode, data_buffer, inode.size);
+
+	stats_op_end(&fs->stats);
+	return data_buffer;
+}
+
+
+// Read the data file at path into the caller's buffer, up to size bytes.
+// Returns how many bytes were read: the whole file, if it fits.
+int read_file_into(llfs_t* fs, char* path, void* buffer, int size) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+	stats_op_begin(&fs->stats, OP_READ_FILE);
+
+	struct inode inode;
+	find_data_file(fs, path, &inode);
+
+	if (size > (int)inode.size) {
+		size = inode.size;
+	}
+	read_inode_data(fs, &inode, buffer, size);
+
+	stats_op_end(&fs->stats);
+	return size;
+}
+
+
+/**
+ * Writing files. A write never changes bytes the last commit points at:
+ * the blocks holding any it overwrites are moved to new blocks, and the
+ * write goes there, so a block it only covers part of is read from its
+ * old place first. A write past the end grows the file instead of
+ * remaking it: new blocks go after the last one. Either way only the
+ * inode (and map blocks, if the file has them) change, and those go
+ * through the journal like every other operation's, so a crash part way
+ * through leaves the file's old size, blocks and contents.
+ */
+
+// Whether there's room to grow a file with the given map to new_size
+// bytes and move moved of its blocks, if every new block ended up in an
+// extent of its own
+int room_to_grow(llfs_t* fs, const struct inode* inode, const struct file_map* map, int new_size,
+		int moved) {
+
+	int extra = blocks_for_size(fs, new_size) - blocks_for_size(fs, inode->size);
+	if (extra < 0) {
+		extra = 0;
+	}
+	if (extra + moved == 0) {
+		return 1;
+	}
+
+	// Moving blocks out of the middle of an extent splits it in two
+	long nextents = map->nextents + extra + moved + 1;
+	if (nextents > max_file_extents(fs)) {
+		nextents = max_file_extents(fs);
+	}
+	return bitmap_count_free(&fs->fbv) >= extra + moved + map_blocks_needed(fs, (int)nextents);
+}
+
+
+// Write count bytes at offset in the data file at path (inode inode_num)
+// as one transaction, growing it if they go past the end
+void write_to_file(llfs_t* fs, char* path, int inode_num, int offset,
+		const unsigned char* data, int count) {
+
+	struct inode inode;
+	read_inode(fs, inode_num, &inode);
+	struct file_map map;
+	load_file_map(fs, &inode, &map);
+
+	int old_size = inode.size;
+	int new_size = (offset + count > old_size) ? offset + count : old_size;
+
+	// The blocks holding bytes that the write changes
+	int block_size = fs->sb.block_size;
+	int moved_first = offset / block_size;
+	int moved = 0;
+	if (offset < old_size) {
+		int moved_end = (offset + count < old_size) ? offset + count : old_size;
+		moved = (moved_end - 1) / block_size - moved_first + 1;
+	}
+
+	// Make sure there's room before starting anything we'd have to undo
+	if (!room_to_grow(fs, &inode, &map, new_size, moved)) {
+		printf("There's no room to write %d bytes to \'%s\' at offset %d!\n", count, path, offset);
+		exit(-1);
+	}
+	int new_blocks = blocks_for_size(fs, new_size) - blocks_for_size(fs, old_size);
+	check_transaction_room(fs, path, 1, map.nextents + new_blocks + moved + 1);
+
+	// The parts of blocks the write doesn't cover come from where they are now
+	int first, nblocks;
+	unsigned char* buffer = prepare_write(fs, map.extents, map.nextents, old_size,
+			offset, count, data, &first, &nblocks);
+
+	if (new_size > old_size) {
+		grow_file(fs, &inode, &map, new_size);
+	}
+	if (moved > 0) {
+		relocate_blocks(fs, &inode, &map, moved_first, moved);
+	}
+	if (new_size > old_size || moved > 0) {
+		write_inode(fs, inode_num, &inode);
+	}
+
+	int* block_nums = malloc(sizeof(int) * nblocks);
+	extent_range_blocks(map.extents, map.nextents, first, nblocks, block_nums);
+	fs_write_blocks(fs, ROLE_DATA, block_nums, nblocks, buffer);
+	free(block_nums);
+	free(buffer);
+
+	commit(fs);
+	destroy_file_map(&map);
+
+	// Handles on the file have to see its new size and blocks
+	reload_open_files(fs, inode_num);
+}
+
+
+// Write data_size bytes at offset in the data file at path. Writing past
+// the end grows the file; if offset is past the end, the gap reads back
+// as zeros.
+void write_file(llfs_t* fs, char* path, int offset, unsigned char* data, int data_size) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+	stats_op_begin(&fs->stats, OP_WRITE_FILE);
+
+	struct inode inode;
+	int inode_num = find_data_inode(fs, path, &inode);
+
+	if (offset < 0) {
+		printf("Can't write at %d, before the start of \'%s\'!\n", offset, path);
+		exit(-1);
+	}
+	if (data_size > 0) {
+		write_to_file(fs, path, inode_num, offset, data, data_size);
+		read_inode(fs, inode_num, &inode);
+	}
+
+	printf("Wrote %d bytes to \'%s\' at offset %d; it's %d bytes now\n\n",
+			data_size, path, offset, inode.size);
+	stats_op_end(&fs->stats);
+}
+
+
+// Add data_size bytes to the end of the data file at path
+void append_file(llfs_t* fs, char* path, unsigned char* data, int data_size) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+
+	struct inode inode;
+	find_data_inode(fs, path, &inode);
+	write_file(fs, path, inode.size, data, data_size);
+}
+
+
+// Write count bytes at offset in an open file, and return how many were
+// written. It's an operation like write_file(), without looking up the
+// path: overwritten blocks move and a write past the end grows the file,
+// all in one transaction. Like write(2), the data isn't necessarily on
+// disk until the next commit or unmount.
+int llfs_pwrite(llfs_t* fs, int fd, const void* data, int count, int offset) {
+
+	struct open_file* f = get_open_file(fs, fd);
+	if (offset < 0 || count <= 0) {
+		return 0;
+	}
+
+	llfs_flush(fs);
+	stats_op_begin(&fs->stats, OP_PWRITE);
+	write_to_file(fs, f->path, f->inode_num, offset, data, count);
+	stats_op_end(&fs->stats);
+	return count;
+}
+
+
+// Write at an open file's current offset, and move past what was written
+int llfs_write(llfs_t* fs, int fd, const void* data, int count) {
+
+	int n = llfs_pwrite(fs, fd, data, count, get_open_file(fs, fd)->offset);
+	fs->files[fd].offset += n;
+	return n;
+}
+
+
+// Recursive helper function to delete subfiles, if any exist.
+// For a directory, dir_data can hold all its blocks if the caller already read them.
+void recursive_delete(llfs_t* fs, int inode_num, unsigned char* dir_data) {
+
+	struct inode inode;
+	read_inode(fs, inode_num, &inode);
+
+	// If the file is a directory, recursive delete all subfiles
+	if (inode.flags == 0) {
+		dindex_forget(fs->dir_tables, inode_num);
+
+		int nblocks = inode.size / fs->sb.block_size;
+		unsigned char* block_buffer = dir_data;
+		if (block_buffer == NULL) {
+			int* blocks;
+			list_file_blocks(fs, &inode, &blocks);
+			block_buffer = malloc((size_t)nblocks * fs->sb.block_size);
+			fs_read_blocks(fs, ROLE_DIRECTORY, blocks, nblocks, block_buffer);
+			free(blocks);
+		}
+
+		long max_entries = (long)nblocks * (fs->sb.block_size / DIR_ENTRY_SIZE);
+		int* children = malloc(sizeof(int) * max_entries);
+		int* child_is_dir = malloc(sizeof(int) * max_entries);
+		int* subdir_blocks = NULL;
+		int nchildren = 0;
+		int nsubdir_blocks = 0;
+
+		struct inode child_inode;
+		for (long i=0; i<max_entries; i++) {
+			unsigned int entry_inode = *(unsigned int*)(block_buffer + i*DIR_ENTRY_SIZE);
+			if (entry_inode == 0) {
+				continue;
+			}
+			const char* name = (const char*)block_buffer + i*DIR_ENTRY_SIZE + 4;
+			dcache_forget(fs->dentries, inode_num, name, strlen(name));
+
+			read_inode(fs, entry_inode, &child_inode);
+			child_is_dir[nchildren] = (child_inode.flags == 0);
+			if (child_is_dir[nchildren]) {
+				int* blocks;
+				int count = list_file_blocks(fs, &child_inode, &blocks);
+				subdir_blocks = realloc(subdir_blocks, sizeof(int) * (nsubdir_blocks + count));
+				memcpy(subdir_blocks + nsubdir_blocks, blocks, sizeof(int) * count);
+				nsubdir_blocks += count;
+				free(blocks);
+			}
+			children[nchildren++] = entry_inode;
+		}
+
+		// Fetch every subdirectory's blocks at once instead of one batch per recursion
+		unsigned char* subdir_data = malloc((size_t)nsubdir_blocks * fs->sb.block_size);
+		fs_read_blocks(fs, ROLE_DIRECTORY, subdir_blocks, nsubdir_blocks, subdir_data);
+
+		unsigned char* next_subdir = subdir_data;
+		for (int i=0; i<nchildren; i++) {
+			if (child_is_dir[i]) {
+				read_inode(fs, children[i], &child_inode);
+				recursive_delete(fs, children[i], next_subdir);
+				next_subdir += child_inode.size;
+			} else {
+				recursive_delete(fs, children[i], NULL);
+			}
+		}
+
+		free(subdir_data);
+		free(subdir_blocks);
+		free(child_is_dir);
+		free(children);
+		if (dir_data == NULL) {
+			free(block_buffer);
+		}
+	}
+
+	// Give every block of this file back to the FBV
+	struct file_map map;
+	load_file_map(fs, &inode, &map);
+	free_file_blocks(fs, &map);
+	destroy_file_map(&map);
+
+	// Lastly, delete the inode from our inode storage blocks
+	struct inode blank_inode = {0};
+	write_inode(fs, inode_num, &blank_inode);
+	bitmap_unmark(&fs->ibm, inode_num - 1);
+	invalidate_open_files(fs, inode_num);
+}
+
+
+// Delete the specified file, as well as any subfiles
+void delete_file(llfs_t* fs, char* path) {
+
+	mount_fs(fs);
+	llfs_flush(fs);
+	check_transaction_room(fs, path, fs->sb.inode_blocks, 0);
+	stats_op_begin(&fs->stats, OP_DELETE_FILE);
+
+	printf("Deleting \'%s\'\n\n", path);
+
+	struct path_component name;
+	int dir_len;
+	last_component(path, &name, &dir_len);
+
+	int inode_num = find_inode_num(fs, path);
+	recursive_delete(fs, inode_num, NULL);
+
+	// Remove this entry from the parent directory
+	remove_entry_from_parent(fs, name.name, name.len, find_parent_inode(fs, path));
+
+	// If it was a directory, no path through it leads anywhere now. The
+	// path cache only holds canonical paths, so if this one isn't, there's
+	// no telling which entries are under it.
+	int path_len = name.name + name.len - path;
+	if (is_canonical(path, path_len)) {
+		dcache_forget_prefix(fs->paths, 0, path, path_len);
+	} else {
+		dcache_clear(fs->paths);
+	}
+
+	commit(fs);
+	stats_op_end(&fs->stats);
+}
+
+
+// Crash at the given point of the next journal commit, which happens now
+// if the operation that just ran didn't make one
+void crash_at_commit(llfs_t* fs) {
+
+	if (fs->crash_point != 0) {
+		journal_commit(fs);
+	}
+}
+
+
+// Simulate a crash while writing a file at path -- for testing purposes
+void simulate_write_crash(llfs_t* fs, char* path, unsigned char* data, int data_len) {
+
+	printf("Simulating a crash while writing a file at %s...\n", path);
+
+	llfs_flush(fs);
+	fs->crash_point = CRASH_BEFORE_LOG;
+	make_datafile(fs, path, data, data_len);
+	llfs_flush(fs);
+	crash_at_commit(fs);
+}
+
+
+// Simulate a crash while appending to the file at path -- for testing purposes
+void simulate_append_crash(llfs_t* fs, char* path, unsigned char* data, int data_len) {
+
+	printf("Simulating a crash while appending to the file at %s...\n", path);
+
+	llfs_flush(fs);
+	fs->crash_point = CRASH_BEFORE_LOG;
+	append_file(fs, path, data, data_len);
+	crash_at_commit(fs);
+}
+
+
+// Simulate a crash while overwriting part of the file at path -- for testing purposes
+void simulate_overwrite_crash(llfs_t* fs, char* path, int offset, unsigned char* data, int data_len) {
+
+	printf("Simulating a crash while overwriting the file at %s...\n", path);
+
+	llfs_flush(fs);
+	fs->crash_point = CRASH_BEFORE_LOG;
+	write_file(fs, path, offset, data, data_len);
+	crash_at_commit(fs);
+}
+
+
+// Simulate a crash before a transaction commits -- for testing purposes.
+// Everything it changed was only in memory, so it's all lost.
+void simulate_transaction_crash(llfs_t* fs) {
+
+	printf("Simulating a crash before committing the transaction...\n");
+
+	crash(fs);
+}
+
+
+// Simulate a crash while deleting a file at path -- for testing purposes
+void simulate_delete_crash(llfs_t* fs, char* path) {
+
+	printf("Simulating a crash while deleting a file at %s...\n", path);
+
+	llfs_flush(fs);
+	fs->crash_point = CRASH_BEFORE_LOG;
+	delete_file(fs, path);
+	crash_at_commit(fs);
+}
+
+
+// Simulate a crash right after deleting a file at path commits, before
+// any of the blocks it changed reach their homes -- for testing purposes
+void simulate_committed_delete_crash(llfs_t* fs, char* path) {
+
+	printf("Simulating a crash after deleting a file at %s...\n", path);
+
+	llfs_flush(fs);
+	fs->crash_point = CRASH_AFTER_LOG;
+	delete_file(fs, path);
+	crash_at_commit(fs);
+}
+
+
+// Initialize the root directory, which lives in its own reserved block
+void init_root(llfs_t* fs) {
+
+	// First, allocate the inode
+	struct inode inode = {0};
+	inode.size = fs->sb.block_size; // default size of a directory file
+	inode.flags = 0; // indicates root is a directory
+
+	// The root directory only uses its one block
+	inode.extents[0].start = fs->sb.root_block;
+	inode.extents[0].length = 1;
+
+	write_inode(fs, 1, &inode);
+	write_back_inodes(fs);
+	bitmap_mark(&fs->ibm, 0);
+
+	// We know the root block is zero-initialized, so we'll just mark it as in-use.
+	bitmap_mark(&fs->fbv, fs->sb.root_block);
+}
+
+
+// Initialize the free-block vector and inode bitmap. Every block up to
+// (but not including) the root directory is reserved, and so are the bits
+// past the last block or inode.
+void init_bitmaps(llfs_t* fs) {
+
+	bitmap_destroy(&fs->fbv);
+	bitmap_create(&fs->fbv, fs->sb.num_blocks);
+	bitmap_unmark_range(&fs->fbv, fs->sb.root_block, fs->sb.num_blocks);
+
+	bitmap_destroy(&fs->ibm);
+	bitmap_create(&fs->ibm, fs->sb.num_inodes);
+	bitmap_unmark_range(&fs->ibm, 0, fs->sb.num_inodes);
+}
+
+
+// Initialize the superblock (block 0) with our file system's metadata
+void init_superblock(llfs_t* fs) {
+
+	unsigned char* buffer = calloc(fs->sb.block_size, 1);
+	memcpy(buffer, &fs->sb, sizeof(struct superblock));
+
+	fs_write_block(fs, 0, buffer);
+	free(buffer);
+}
+
+
+// Work out where everything goes for the given geometry: superblock, FBV,
+// inode bitmap, journal, i-node blocks, root directory
+void compute_layout(llfs_t* fs, int block_size, int num_blocks, int num_inodes) {
+
+	fs->sb.magic = MAGIC_NUMBER;
+	fs->sb.num_blocks = num_blocks;
+	fs->sb.num_inodes = num_inodes;
+	fs->sb.block_size = block_size;
+
+	long bits_per_block = (long)block_size * 8;
+	int inodes_per_block = block_size / INODE_SIZE;
+
+	fs->sb.fbv_start = 1;
+	fs->sb.fbv_blocks = (num_blocks + bits_per_block - 1) / bits_per_block;
+	fs->sb.ibm_start = fs->sb.fbv_start + fs->sb.fbv_blocks;
+	fs->sb.ibm_blocks = (num_inodes + bits_per_block - 1) / bits_per_block;
+	fs->sb.inode_blocks = (num_inodes + inodes_per_block - 1) / inodes_per_block;
+
+	// The log has to hold the biggest operation there can be, with its
+	// header block on top
+	fs->sb.journal_start = fs->sb.ibm_start + fs->sb.ibm_blocks;
+	fs->sb.journal_blocks = num_blocks / JOURNAL_FRACTION;
+	if (fs->sb.journal_blocks < MIN_JOURNAL_BLOCKS) {
+		fs->sb.journal_blocks = MIN_JOURNAL_BLOCKS;
+	}
+	if (fs->sb.journal_blocks < transaction_log_blocks(fs, max_op_blocks(fs)) + 1) {
+		fs->sb.journal_blocks = transaction_log_blocks(fs, max_op_blocks(fs)) + 1;
+	}
+	fs->sb.inode_start = fs->sb.journal_start + fs->sb.journal_blocks;
+	fs->sb.root_block = fs->sb.inode_start + fs->sb.inode_blocks;
+	fs->sb.data_start = fs->sb.root_block + 1;
+	fs->sb.group_blocks = bits_per_block;
+}
+
+
+// Initialize the file system with the given block size (a power of 2,
+// at least MIN_BLOCK_SIZE bytes), number of blocks and number of inodes
+void init_fs(llfs_t* fs, int block_size, int num_blocks, int num_inodes) {
+
+	if (block_size < MIN_BLOCK_SIZE || (block_size & (block_size - 1)) != 0) {
+		printf("Invalid block size %d: it has to be a power of 2, at least %d\n",
+				block_size, MIN_BLOCK_SIZE);
+		exit(-1);
+	}
+	if (num_inodes < 1) {
+		printf("Invalid inode count %d: the root directory needs one\n", num_inodes);
+		exit(-1);
+	}
+
+	compute_layout(fs, block_size, num_blocks, num_inodes);
+	if (num_blocks <= fs->sb.data_start) {
+		printf("A disk of %d blocks is too small to hold a file system\n", num_blocks);
+		exit(-1);
+	}
+
+	stats_op_begin(&fs->stats, OP_INIT);
+
+	discard_pending(fs);
+	discard_transaction(fs);
+	invalidate_open_files(fs, 0);
+	set_disk_geometry(fs->disk, block_size, num_blocks);
+	wipe_disk(fs->disk);
+	fs->sb_loaded = 1;
+
+	reset_caches(fs);
+
+	init_superblock(fs);
+	init_bitmaps(fs);
+	init_root(fs);
+
+	store_bitmap(fs, &fs->fbv, fs->sb.fbv_start, fs->sb.fbv_blocks);
+	store_bitmap(fs, &fs->ibm, fs->sb.ibm_start, fs->sb.ibm_blocks);
+	fs->fbv.dirty = 0;
+	fs->ibm.dirty = 0;
+
+	// An empty journal, and a running transaction to start it off
+	fs->journal_head = 0;
+	fs->journal_used = 0;
+	fs->journal_sequence = 1;
+	write_journal_header(fs);
+	bitmap_create(&fs->logged, fs->sb.num_blocks);
+	start_running(fs);
+	sync_disk(fs->disk);
+
+	stats_op_end(&fs->stats);
+}
+
+
+// Initialize the file system with one inode for every BYTES_PER_INODE
+// bytes of disk
+void init(llfs_t* fs, int block_size, int num_blocks) {
+
+	long num_inodes = (long)block_size * num_blocks / BYTES_PER_INODE;
+	if (num_inodes < 1) {
+		num_inodes = 1;
+	}
+	init_fs(fs, block_size, num_blocks, (int)num_inodes);
+}
+void InitLLFS(llfs_t* fs) { init(fs, DEFAULT_BLOCK_SIZE, DEFAULT_NUM_BLOCKS); }
@@ -1,19 +1,85 @@
-void InitLLFS();
+// A mounted file system; every call below works on the one it's given
+typedef struct llfs llfs_t;
 
-void init();
+struct disk;
+struct iovec;
 
-void make_dir();
+llfs_t* llfs_mount(const char* image_path);
 
-void make_datafile();
+void llfs_unmount(llfs_t* fs);
 
-unsigned char* read_file();
+void llfs_snapshot(llfs_t* fs, const char* image_path);
 
-void delete_file();
+void llfs_load(llfs_t* fs, const char* image_path);
 
-void print_block();
+struct disk* llfs_disk(llfs_t* fs);
 
-void simulate_write_crash();
+void InitLLFS(llfs_t* fs);
 
-void simulate_delete_crash();
+void init(llfs_t* fs, int block_size, int num_blocks);
 
-void sys_recover();
\ No newline at end of file
+void init_fs(llfs_t* fs, int block_size, int num_blocks, int num_inodes);
+
+void llfs_set_group_commit(llfs_t* fs, int nops);
+
+void llfs_sync(llfs_t* fs);
+
+void llfs_begin_transaction(llfs_t* fs);
+
+int llfs_transaction_has_room(llfs_t* fs);
+
+void llfs_commit_transaction(llfs_t* fs);
+
+void make_dir(llfs_t* fs, char* path);
+
+void make_datafile(llfs_t* fs, char* path, unsigned char* data, int data_size);
+
+void llfs_set_delayed_alloc(llfs_t* fs, int enabled);
+
+void llfs_flush(llfs_t* fs);
+
+unsigned char* read_file(llfs_t* fs, char* path);
+
+int read_file_into(llfs_t* fs, char* path, void* buffer, int size);
+
+void write_file(llfs_t* fs, char* path, int offset, unsigned char* data, int data_size);
+
+void append_file(llfs_t* fs, char* path, unsigned char* data, int data_size);
+
+int llfs_open(llfs_t* fs, char* path);
+
+void llfs_close(llfs_t* fs, int fd);
+
+int llfs_pread(llfs_t* fs, int fd, void* buffer, int count, int offset);
+
+int llfs_preadv(llfs_t* fs, int fd, const struct iovec* iov, int iovcnt, int offset);
+
+int llfs_pwrite(llfs_t* fs, int fd, const void* data, int count, int offset);
+
+int llfs_read(llfs_t* fs, int fd, void* buffer, int count);
+
+int llfs_write(llfs_t* fs, int fd, const void* data, int count);
+
+int llfs_seek(llfs_t* fs, int fd, int offset, int whence);
+
+void delete_file(llfs_t* fs, char* path);
+
+void print_block(llfs_t* fs, int block_num);
+
+void simulate_write_crash(llfs_t* fs, char* path, unsigned char* data, int data_len);
+
+void simulate_append_crash(llfs_t* fs, char* path, unsigned char* data, int data_len);
+
+void simulate_overwrite_crash(llfs_t* fs, char* path, int offset, unsigned char* data, int data_len);
+
+void simulate_transaction_crash(llfs_t* fs);
+
+void simulate_delete_crash(llfs_t* fs, char* path);
+
+void simulate_committed_delete_crash(llfs_t* fs, char* path);
+
+void sys_recover(llfs_t* fs);
+
+void print_stats(llfs_t* fs, int as_json);
+
+void reset_stats(llfs_t* fs);
@@ -0,0 +1,279 @@
+/**
+ * bitmap.c - In-memory allocation bitmaps for LLFS.
+ *
+ * On disk a bitmap is a run of bytes, most significant bit first, with a
+ * 1 for every free item. In memory it's kept as 64-bit words, least
+ * significant bit first, so free items can be found a word at a time
+ * with count-trailing-zeros. bitmap_load() and bitmap_store() convert
+ * between the two.
+ *
+ * Searches start at the hint word rather than word 0: everything before
+ * it is known to be in use. Taking items only ever moves the first free
+ * bit forward, and freeing one pulls the hint back, so allocating from a
+ * mostly-full bitmap stays cheap.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+
+
+// Flip a byte end for end, so the disk's MSB-first order becomes LSB-first
+static unsigned char reverse_bits(unsigned char b) {
+
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+
+// An all-used bitmap big enough for num_bits items, rounded up to whole
+// words. The on-disk form is num_words * 8 bytes.
+void bitmap_create(struct bitmap* bm, int num_bits) {
+
+	bm->num_bits = num_bits;
+	bm->num_words = (num_bits + 63) / 64;
+	bm->words = calloc(bm->num_words, sizeof(uint64_t));
+	bm->dirty = 0;
+	bm->hint = 0;
+}
+
+
+void bitmap_destroy(struct bitmap* bm) {
+
+	free(bm->words);
+	bm->words = NULL;
+}
+
+
+// Make dst (not yet created) a copy of src
+void bitmap_copy(struct bitmap* dst, const struct bitmap* src) {
+
+	bitmap_create(dst, src->num_bits);
+	memcpy(dst->words, src->words, src->num_words * sizeof(uint64_t));
+	dst->hint = src->hint;
+}
+
+
+void bitmap_load(struct bitmap* bm, const unsigned char* bytes) {
+
+	for (int w=0; w<bm->num_words; w++) {
+		uint64_t word = 0;
+		for (int i=0; i<8; i++) {
+			word |= (uint64_t)reverse_bits(bytes[w*8 + i]) << (i*8);
+		}
+		bm->words[w] = word;
+	}
+	bm->dirty = 0;
+	bm->hint = 0;
+}
+
+
+void bitmap_store(struct bitmap* bm, unsigned char* bytes) {
+
+	for (int w=0; w<bm->num_words; w++) {
+		for (int i=0; i<8; i++) {
+			bytes[w*8 + i] = reverse_bits((unsigned char)(bm->words[w] >> (i*8)));
+		}
+	}
+}
+
+
+// Mark every item from start up to (not including) end as free
+void bitmap_unmark_range(struct bitmap* bm, int start, int end) {
+
+	for (int i=start; i<end; i++) {
+		bm->words[i / 64] |= (uint64_t)1 << (i % 64);
+	}
+	if (start < end && start / 64 < bm->hint) {
+		bm->hint = start / 64;
+	}
+	bm->dirty = 1;
+}
+
+
+// Mark every item that's free in other as free in bm too
+void bitmap_merge_free(struct bitmap* bm, const struct bitmap* other) {
+
+	for (int w=0; w<bm->num_words; w++) {
+		if ((other->words[w] & ~bm->words[w]) != 0) {
+			bm->words[w] |= other->words[w];
+			bm->dirty = 1;
+			if (w < bm->hint) {
+				bm->hint = w;
+			}
+		}
+	}
+}
+
+
+// Whether some item is free in both bitmaps, which have the same size
+int bitmap_shares_free(const struct bitmap* bm, const struct bitmap* other) {
+
+	for (int w=0; w<bm->num_words; w++) {
+		if ((bm->words[w] & other->words[w]) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+int bitmap_is_free(struct bitmap* bm, int item) {
+
+	return (bm->words[item / 64] >> (item % 64)) & 1;
+}
+
+
+int bitmap_count_free(struct bitmap* bm) {
+
+	int count = 0;
+	for (int w=0; w<bm->num_words; w++) {
+		count += __builtin_popcountll(bm->words[w]);
+	}
+	return count;
+}
+
+
+// How many items between start and (not including) end are free
+int bitmap_count_free_range(struct bitmap* bm, int start, int end) {
+
+	int count = 0;
+	for (int w = start / 64; start < end && w <= (end - 1) / 64; w++) {
+		uint64_t word = bm->words[w];
+		if (w == start / 64) {
+			word &= ~(uint64_t)0 << (start % 64);
+		}
+		if (w == (end - 1) / 64 && end % 64 != 0) {
+			word &= ~(~(uint64_t)0 << (end % 64));
+		}
+		count += __builtin_popcountll(word);
+	}
+	return count;
+}
+
+
+// The lowest free item, or -1 if there isn't one. Doesn't take it.
+int bitmap_find_free(struct bitmap* bm) {
+
+	for (int w=bm->hint; w<bm->num_words; w++) {
+		if (bm->words[w] != 0) {
+			bm->hint = w;
+			return w*64 + __builtin_ctzll(bm->words[w]);
+		}
+	}
+	bm->hint = bm->num_words;
+	return -1;
+}
+
+
+// Find the run of free items that starts at or after from. Returns its
+// start and sets *length, or returns -1 if there are no more free items.
+static int next_run(struct bitmap* bm, int from, int* length) {
+
+	int w = from / 64;
+	if (w < bm->hint) {
+		w = bm->hint;
+		from = w * 64;
+	}
+	if (w >= bm->num_words) {
+		return -1;
+	}
+
+	// First free item: skip whole words of used items
+	uint64_t word = bm->words[w] & (~(uint64_t)0 << (from % 64));
+	while (word == 0) {
+		if (++w == bm->num_words) {
+			return -1;
+		}
+		word = bm->words[w];
+	}
+	int start = w*64 + __builtin_ctzll(word);
+
+	// First used item after it: same thing on the inverted words
+	word = ~bm->words[w] & (~(uint64_t)0 << (start % 64));
+	while (word == 0 && ++w < bm->num_words) {
+		word = ~bm->words[w];
+	}
+	int end = (w < bm->num_words) ? w*64 + __builtin_ctzll(word) : bm->num_words * 64;
+
+	*length = end - start;
+	return start;
+}
+
+
+// The smallest run of at least count free items between from and (not
+// including) to, the earliest if there's a tie, or -1 if none is long
+// enough. Runs are cut off at both ends of the range. Doesn't take it.
+int bitmap_best_fit(struct bitmap* bm, int count, int from, int to) {
+
+	int best = -1;
+	int best_length = 0;
+	int length;
+
+	for (int start = next_run(bm, from, &length); start >= 0 && start < to;
+			start = next_run(bm, start + length, &length)) {
+
+		if (length > to - start) {
+			length = to - start;
+		}
+		if (length >= count && (best < 0 || length < best_length)) {
+			best = start;
+			best_length = length;
+			if (length == count) {
+				break;
+			}
+		}
+	}
+
+	return best;
+}
+
+
+// The longest run of free items (the earliest, if there's a tie). Returns
+// its length and sets *start, or returns 0 if nothing is free.
+int bitmap_longest_run(struct bitmap* bm, int* start) {
+
+	int best_length = 0;
+	int length;
+
+	for (int s = next_run(bm, 0, &length); s >= 0; s = next_run(bm, s + length, &length)) {
+		if (length > best_length) {
+			*start = s;
+			best_length = length;
+		}
+	}
+
+	return best_length;
+}
+
+
+// Mark every item from start up to (not including) end as in use
+void bitmap_mark_range(struct bitmap* bm, int start, int end) {
+
+	for (int i=start; i<end; i++) {
+		bm->words[i / 64] &= ~((uint64_t)1 << (i % 64));
+	}
+	bm->dirty = 1;
+}
+
+
+// Mark an item as in use
+void bitmap_mark(struct bitmap* bm, int item) {
+
+	bm->words[item / 64] &= ~((uint64_t)1 << (item % 64));
+	bm->dirty = 1;
+}
+
+
+// Mark an item as free again
+void bitmap_unmark(struct bitmap* bm, int item) {
+
+	bm->words[item / 64] |= (uint64_t)1 << (item % 64);
+	if (item / 64 < bm->hint) {
+		bm->hint = item / 64;
+	}
+	bm->dirty = 1;
+}
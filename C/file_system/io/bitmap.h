@@ -0,0 +1,47 @@
+/**
+ * bitmap.h - In-memory allocation bitmaps for LLFS (1 = free).
+ */
+
+#include <stdint.h>
+
+struct bitmap {
+	uint64_t* words;	// bit i of words[w] is item w*64 + i
+	int num_words;
+	int num_bits;		// bits at or past this are never free
+	int dirty;			// changed since it was last written out; up to the caller to clear
+	int hint;			// no word before this one has a free bit
+};
+
+void bitmap_create(struct bitmap* bm, int num_bits);
+
+void bitmap_destroy(struct bitmap* bm);
+
+void bitmap_copy(struct bitmap* dst, const struct bitmap* src);
+
+void bitmap_load(struct bitmap* bm, const unsigned char* bytes);
+
+void bitmap_store(struct bitmap* bm, unsigned char* bytes);
+
+void bitmap_mark_range(struct bitmap* bm, int start, int end);
+
+void bitmap_unmark_range(struct bitmap* bm, int start, int end);
+
+void bitmap_merge_free(struct bitmap* bm, const struct bitmap* other);
+
+int bitmap_shares_free(const struct bitmap* bm, const struct bitmap* other);
+
+int bitmap_is_free(struct bitmap* bm, int item);
+
+int bitmap_count_free(struct bitmap* bm);
+
+int bitmap_count_free_range(struct bitmap* bm, int start, int end);
+
+int bitmap_find_free(struct bitmap* bm);
+
+int bitmap_best_fit(struct bitmap* bm, int count, int from, int to);
+
+int bitmap_longest_run(struct bitmap* bm, int* start);
+
+void bitmap_mark(struct bitmap* bm, int item);
+
+void bitmap_unmark(struct bitmap* bm, int item);
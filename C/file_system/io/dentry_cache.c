@@ -0,0 +1,222 @@
+/**
+ * dentry_cache.c - LRU cache of name lookups for LLFS.
+ *
+ * Each entry maps a directory's inode number and a name to the inode the
+ * name refers to. File.c keeps two of these: one for directory entries,
+ * and one for whole directory paths (with 0 as the directory). Entries
+ * are found through a hash table and kept on a doubly-linked list in
+ * least-recently-used order; only num_slots of them are kept. Misses
+ * aren't cached, so there's nothing to undo when a file is created.
+ * Names come in as a pointer and a length, so callers can pass pieces of
+ * a longer path without copying them out first.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dentry_cache.h"
+
+struct dentry {
+	int dir;
+	char* name;
+	int len;
+	unsigned int hash;
+	int inode_num;
+
+	struct dentry* prev;	// LRU list, most recent at the head
+	struct dentry* next;
+	struct dentry* hnext;	// hash chain
+};
+
+struct dentry_cache {
+	int num_slots;
+	int num_entries;
+
+	struct dentry** buckets;
+	int num_buckets;	// a power of 2
+
+	struct dentry* head;
+	struct dentry* tail;
+
+	long hits;
+	long misses;
+};
+
+
+// FNV-1a over the directory's inode number, then the name
+static unsigned int key_hash(int dir, const char* name, int len) {
+
+	unsigned int hash = 2166136261u;
+	for (int i=0; i<4; i++) {
+		hash ^= (unsigned int)dir >> (i*8) & 0xFF;
+		hash *= 16777619u;
+	}
+	for (int i=0; i<len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+static void lru_unlink(struct dentry_cache* dc, struct dentry* d) {
+
+	if (d->prev) d->prev->next = d->next;
+	else dc->head = d->next;
+
+	if (d->next) d->next->prev = d->prev;
+	else dc->tail = d->prev;
+}
+
+
+static void lru_push_front(struct dentry_cache* dc, struct dentry* d) {
+
+	d->prev = NULL;
+	d->next = dc->head;
+
+	if (dc->head) dc->head->prev = d;
+	else dc->tail = d;
+
+	dc->head = d;
+}
+
+
+static struct dentry* lookup(struct dentry_cache* dc, int dir, const char* name, int len,
+		unsigned int hash) {
+
+	struct dentry* d = dc->buckets[hash & (dc->num_buckets - 1)];
+	while (d != NULL && (d->hash != hash || d->dir != dir || d->len != len
+			|| memcmp(d->name, name, len) != 0)) {
+		d = d->hnext;
+	}
+	return d;
+}
+
+
+static void remove_entry(struct dentry_cache* dc, struct dentry* d) {
+
+	struct dentry** link = &dc->buckets[d->hash & (dc->num_buckets - 1)];
+	while (*link != d) {
+		link = &(*link)->hnext;
+	}
+	*link = d->hnext;
+
+	lru_unlink(dc, d);
+	dc->num_entries--;
+
+	free(d->name);
+	free(d);
+}
+
+
+struct dentry_cache* dcache_create(int num_slots) {
+
+	struct dentry_cache* dc = calloc(1, sizeof(struct dentry_cache));
+	dc->num_slots = num_slots;
+
+	dc->num_buckets = 1;
+	while (dc->num_buckets < num_slots * 2) {
+		dc->num_buckets *= 2;
+	}
+	dc->buckets = calloc(dc->num_buckets, sizeof(struct dentry*));
+
+	return dc;
+}
+
+
+void dcache_destroy(struct dentry_cache* dc) {
+
+	if (dc == NULL) {
+		return;
+	}
+
+	dcache_clear(dc);
+	free(dc->buckets);
+	free(dc);
+}
+
+
+// The inode a name refers to, or 0 on a miss
+int dcache_get(struct dentry_cache* dc, int dir, const char* name, int len) {
+
+	struct dentry* d = lookup(dc, dir, name, len, key_hash(dir, name, len));
+	if (d == NULL) {
+		dc->misses++;
+		return 0;
+	}
+
+	dc->hits++;
+	lru_unlink(dc, d);
+	lru_push_front(dc, d);
+	return d->inode_num;
+}
+
+
+void dcache_put(struct dentry_cache* dc, int dir, const char* name, int len, int inode_num) {
+
+	unsigned int hash = key_hash(dir, name, len);
+	struct dentry* d = lookup(dc, dir, name, len, hash);
+
+	if (d == NULL) {
+		d = calloc(1, sizeof(struct dentry));
+		d->dir = dir;
+		d->name = malloc(len);
+		memcpy(d->name, name, len);
+		d->len = len;
+		d->hash = hash;
+
+		int b = hash & (dc->num_buckets - 1);
+		d->hnext = dc->buckets[b];
+		dc->buckets[b] = d;
+		dc->num_entries++;
+	} else {
+		lru_unlink(dc, d);
+	}
+
+	d->inode_num = inode_num;
+	lru_push_front(dc, d);
+
+	if (dc->num_entries > dc->num_slots) {
+		remove_entry(dc, dc->tail);
+	}
+}
+
+
+void dcache_forget(struct dentry_cache* dc, int dir, const char* name, int len) {
+
+	struct dentry* d = lookup(dc, dir, name, len, key_hash(dir, name, len));
+	if (d != NULL) {
+		remove_entry(dc, d);
+	}
+}
+
+
+// Forget prefix itself and everything under it: every name in dir that
+// is prefix, or starts with prefix followed by a '/'
+void dcache_forget_prefix(struct dentry_cache* dc, int dir, const char* prefix, int len) {
+
+	struct dentry* d = dc->head;
+	while (d != NULL) {
+		struct dentry* next = d->next;
+		if (d->dir == dir && d->len >= len && memcmp(d->name, prefix, len) == 0
+				&& (d->len == len || d->name[len] == '/')) {
+			remove_entry(dc, d);
+		}
+		d = next;
+	}
+}
+
+
+void dcache_clear(struct dentry_cache* dc) {
+
+	while (dc->head != NULL) {
+		remove_entry(dc, dc->head);
+	}
+}
+
+
+void dcache_get_stats(struct dentry_cache* dc, long* hits, long* misses) {
+
+	*hits = dc->hits;
+	*misses = dc->misses;
+}
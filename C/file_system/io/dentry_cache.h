@@ -0,0 +1,23 @@
+/**
+ * dentry_cache.h - LRU cache of name lookups for LLFS: (directory, name) -> inode.
+ */
+
+#define DEFAULT_DENTRY_CACHE_SIZE 4096
+
+struct dentry_cache;
+
+struct dentry_cache* dcache_create(int num_slots);
+
+void dcache_destroy(struct dentry_cache* dc);
+
+int dcache_get(struct dentry_cache* dc, int dir, const char* name, int len);
+
+void dcache_put(struct dentry_cache* dc, int dir, const char* name, int len, int inode_num);
+
+void dcache_forget(struct dentry_cache* dc, int dir, const char* name, int len);
+
+void dcache_forget_prefix(struct dentry_cache* dc, int dir, const char* prefix, int len);
+
+void dcache_clear(struct dentry_cache* dc);
+
+void dcache_get_stats(struct dentry_cache* dc, long* hits, long* misses);
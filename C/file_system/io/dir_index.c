@@ -0,0 +1,119 @@
+/**
+ * dir_index.c - Cache of directory bucket tables for LLFS.
+ *
+ * A directory is an extendible hash table (see File.c). Its bucket table
+ * has 2^depth slots, and slot i holds the disk block of the bucket for
+ * names whose hash ends in the bits of i. Several slots share a bucket
+ * until that bucket splits. The table isn't stored anywhere: File.c
+ * rebuilds it from the buckets' headers the first time it needs it and
+ * keeps it here, so a lookup costs one block read however big the
+ * directory is. Only num_slots directories are kept; the one used least
+ * recently goes first. There are only ever a few, so they're scanned.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dir_index.h"
+
+struct dir_index {
+	int dir;		// 0 if the slot is empty
+	int depth;
+	int* blocks;	// 2^depth of them
+	long last_used;
+};
+
+struct dir_index_cache {
+	int num_slots;
+	struct dir_index* slots;
+	long clock;
+};
+
+
+struct dir_index_cache* dindex_create(int num_slots) {
+
+	struct dir_index_cache* dx = calloc(1, sizeof(struct dir_index_cache));
+	dx->num_slots = num_slots;
+	dx->slots = calloc(num_slots, sizeof(struct dir_index));
+	return dx;
+}
+
+
+void dindex_destroy(struct dir_index_cache* dx) {
+
+	if (dx == NULL) {
+		return;
+	}
+
+	dindex_clear(dx);
+	free(dx->slots);
+	free(dx);
+}
+
+
+static struct dir_index* find_slot(struct dir_index_cache* dx, int dir) {
+
+	for (int i=0; i<dx->num_slots; i++) {
+		if (dx->slots[i].dir == dir) {
+			return &dx->slots[i];
+		}
+	}
+	return NULL;
+}
+
+
+// A directory's bucket table, or NULL on a miss. The table is only good
+// until the next call that changes the cache.
+const int* dindex_get(struct dir_index_cache* dx, int dir, int* depth) {
+
+	struct dir_index* x = find_slot(dx, dir);
+	if (x == NULL) {
+		return NULL;
+	}
+
+	x->last_used = ++dx->clock;
+	*depth = x->depth;
+	return x->blocks;
+}
+
+
+// Keep a copy of a directory's bucket table, replacing any it had
+void dindex_put(struct dir_index_cache* dx, int dir, int depth, const int* blocks) {
+
+	struct dir_index* x = find_slot(dx, dir);
+	if (x == NULL) {
+		x = &dx->slots[0];
+		for (int i=1; i<dx->num_slots && x->dir != 0; i++) {
+			if (dx->slots[i].dir == 0 || dx->slots[i].last_used < x->last_used) {
+				x = &dx->slots[i];
+			}
+		}
+	}
+
+	size_t size = sizeof(int) << depth;
+	free(x->blocks);
+	x->blocks = malloc(size);
+	memcpy(x->blocks, blocks, size);
+	x->dir = dir;
+	x->depth = depth;
+	x->last_used = ++dx->clock;
+}
+
+
+void dindex_forget(struct dir_index_cache* dx, int dir) {
+
+	struct dir_index* x = find_slot(dx, dir);
+	if (x != NULL) {
+		free(x->blocks);
+		memset(x, 0, sizeof(struct dir_index));
+	}
+}
+
+
+void dindex_clear(struct dir_index_cache* dx) {
+
+	for (int i=0; i<dx->num_slots; i++) {
+		free(dx->slots[i].blocks);
+	}
+	memset(dx->slots, 0, sizeof(struct dir_index) * dx->num_slots);
+}
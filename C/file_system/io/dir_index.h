@@ -0,0 +1,20 @@
+/**
+ * dir_index.h - Cache of directory bucket tables for LLFS: which block
+ * holds each hash slot of a directory.
+ */
+
+#define DEFAULT_DIR_INDEX_CACHE_SIZE 64
+
+struct dir_index_cache;
+
+struct dir_index_cache* dindex_create(int num_slots);
+
+void dindex_destroy(struct dir_index_cache* dx);
+
+const int* dindex_get(struct dir_index_cache* dx, int dir, int* depth);
+
+void dindex_put(struct dir_index_cache* dx, int dir, int depth, const int* blocks);
+
+void dindex_forget(struct dir_index_cache* dx, int dir);
+
+void dindex_clear(struct dir_index_cache* dx);
@@ -0,0 +1,258 @@
+/**
+ * inode_cache.c - LRU cache of decoded inodes for LLFS.
+ *
+ * Entries are found through a hash table on the inode number. Clean
+ * entries sit on a doubly-linked list in least-recently-used order, and
+ * only num_slots of them are kept. Dirty entries are on a list of their
+ * own and are never evicted: they stay until icache_clean() hands them
+ * to the caller to be written back, which File.c does at commit().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "inode_cache.h"
+
+struct icache_entry {
+	int inode_num;
+	int dirty;
+	struct inode inode;
+
+	struct icache_entry* prev;	// LRU list (most recent at the head) or dirty list
+	struct icache_entry* next;
+	struct icache_entry* hnext;	// hash chain
+};
+
+struct inode_cache {
+	int num_slots;		// clean entries to keep
+	int num_clean;
+	int num_dirty;
+
+	struct icache_entry** buckets;
+	int num_buckets;	// a power of 2
+
+	struct icache_entry* head;
+	struct icache_entry* tail;
+	struct icache_entry* dirty;
+
+	long hits;
+	long misses;
+};
+
+
+static int bucket_of(struct inode_cache* ic, int inode_num) {
+
+	return (unsigned int)inode_num * 2654435761u & (ic->num_buckets - 1);
+}
+
+
+static void lru_unlink(struct inode_cache* ic, struct icache_entry* e) {
+
+	if (e->prev) e->prev->next = e->next;
+	else ic->head = e->next;
+
+	if (e->next) e->next->prev = e->prev;
+	else ic->tail = e->prev;
+}
+
+
+static void lru_push_front(struct inode_cache* ic, struct icache_entry* e) {
+
+	e->prev = NULL;
+	e->next = ic->head;
+
+	if (ic->head) ic->head->prev = e;
+	else ic->tail = e;
+
+	ic->head = e;
+}
+
+
+static void hash_remove(struct inode_cache* ic, struct icache_entry* e) {
+
+	struct icache_entry** link = &ic->buckets[bucket_of(ic, e->inode_num)];
+	while (*link != e) {
+		link = &(*link)->hnext;
+	}
+	*link = e->hnext;
+}
+
+
+static struct icache_entry* lookup(struct inode_cache* ic, int inode_num) {
+
+	struct icache_entry* e = ic->buckets[bucket_of(ic, inode_num)];
+	while (e != NULL && e->inode_num != inode_num) {
+		e = e->hnext;
+	}
+	return e;
+}
+
+
+static struct icache_entry* new_entry(struct inode_cache* ic, int inode_num) {
+
+	struct icache_entry* e = calloc(1, sizeof(struct icache_entry));
+	e->inode_num = inode_num;
+
+	int b = bucket_of(ic, inode_num);
+	e->hnext = ic->buckets[b];
+	ic->buckets[b] = e;
+
+	return e;
+}
+
+
+// Drop least recently used clean entries until there are num_slots left
+static void evict(struct inode_cache* ic) {
+
+	while (ic->num_clean > ic->num_slots) {
+		struct icache_entry* e = ic->tail;
+		lru_unlink(ic, e);
+		hash_remove(ic, e);
+		free(e);
+		ic->num_clean--;
+	}
+}
+
+
+struct inode_cache* icache_create(int num_slots) {
+
+	struct inode_cache* ic = calloc(1, sizeof(struct inode_cache));
+	ic->num_slots = num_slots;
+
+	ic->num_buckets = 1;
+	while (ic->num_buckets < num_slots * 2) {
+		ic->num_buckets *= 2;
+	}
+	ic->buckets = calloc(ic->num_buckets, sizeof(struct icache_entry*));
+
+	return ic;
+}
+
+
+void icache_destroy(struct inode_cache* ic) {
+
+	if (ic == NULL) {
+		return;
+	}
+
+	for (int b=0; b<ic->num_buckets; b++) {
+		struct icache_entry* e = ic->buckets[b];
+		while (e != NULL) {
+			struct icache_entry* next = e->hnext;
+			free(e);
+			e = next;
+		}
+	}
+
+	free(ic->buckets);
+	free(ic);
+}
+
+
+// Copy a cached inode out; returns 0 on a miss
+int icache_get(struct inode_cache* ic, int inode_num, struct inode* inode) {
+
+	struct icache_entry* e = lookup(ic, inode_num);
+	if (e == NULL) {
+		ic->misses++;
+		return 0;
+	}
+
+	ic->hits++;
+	if (!e->dirty) {
+		lru_unlink(ic, e);
+		lru_push_front(ic, e);
+	}
+
+	*inode = e->inode;
+	return 1;
+}
+
+
+// Cache an inode just read off the disk, after icache_get() missed
+void icache_fill(struct inode_cache* ic, int inode_num, const struct inode* inode) {
+
+	if (lookup(ic, inode_num) != NULL) {
+		return;
+	}
+
+	struct icache_entry* e = new_entry(ic, inode_num);
+	e->inode = *inode;
+	lru_push_front(ic, e);
+	ic->num_clean++;
+	evict(ic);
+}
+
+
+// Change an inode. It stays in the cache, dirty, until icache_clean().
+void icache_put(struct inode_cache* ic, int inode_num, const struct inode* inode) {
+
+	struct icache_entry* e = lookup(ic, inode_num);
+
+	if (e == NULL) {
+		e = new_entry(ic, inode_num);
+	} else if (!e->dirty) {
+		lru_unlink(ic, e);
+		ic->num_clean--;
+	}
+
+	e->inode = *inode;
+
+	if (!e->dirty) {
+		e->dirty = 1;
+		e->next = ic->dirty;
+		ic->dirty = e;
+		ic->num_dirty++;
+	}
+}
+
+
+int icache_num_dirty(struct inode_cache* ic) {
+
+	return ic->num_dirty;
+}
+
+
+static int compare_entries(const void* a, const void* b) {
+
+	const struct icache_entry* x = *(const struct icache_entry**)a;
+	const struct icache_entry* y = *(const struct icache_entry**)b;
+	return (x->inode_num > y->inode_num) - (x->inode_num < y->inode_num);
+}
+
+
+// Copy every dirty inode out, in inode order, and mark them clean. The
+// arrays need room for icache_num_dirty() inodes; the caller is expected
+// to write them all back before anything else happens.
+void icache_clean(struct inode_cache* ic, int* inode_nums, struct inode* inodes) {
+
+	struct icache_entry** dirty = malloc(sizeof(struct icache_entry*) * (ic->num_dirty + 1));
+	int ndirty = 0;
+	for (struct icache_entry* e = ic->dirty; e != NULL; e = e->next) {
+		dirty[ndirty++] = e;
+	}
+
+	qsort(dirty, ndirty, sizeof(struct icache_entry*), compare_entries);
+
+	for (int i=0; i<ndirty; i++) {
+		inode_nums[i] = dirty[i]->inode_num;
+		inodes[i] = dirty[i]->inode;
+
+		dirty[i]->dirty = 0;
+		lru_push_front(ic, dirty[i]);
+		ic->num_clean++;
+	}
+
+	ic->dirty = NULL;
+	ic->num_dirty = 0;
+	evict(ic);
+
+	free(dirty);
+}
+
+
+void icache_get_stats(struct inode_cache* ic, long* hits, long* misses) {
+
+	*hits = ic->hits;
+	*misses = ic->misses;
+}
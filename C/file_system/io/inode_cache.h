@@ -0,0 +1,41 @@
+/**
+ * inode_cache.h - Decoded inodes, and an LRU cache of them for LLFS.
+ */
+
+#define INODE_SIZE 64
+#define NUM_EXTENTS 6		// block runs per inode
+#define DEFAULT_INODE_CACHE_SIZE 1024
+
+// A run of consecutive blocks, as stored in an inode: start, then length.
+// A length of 0 marks an unused slot.
+struct extent {
+	unsigned int start;
+	unsigned int length;
+};
+
+// An inode exactly as it's laid out on disk, INODE_SIZE bytes
+struct inode {
+	unsigned int size;
+	unsigned int flags;		// 0 for a directory, 1 for a data file
+	struct extent extents[NUM_EXTENTS];
+	unsigned int indirect;			// block of further extents, or 0
+	unsigned int double_indirect;	// block of pointers to more such blocks, or 0
+};
+
+struct inode_cache;
+
+struct inode_cache* icache_create(int num_slots);
+
+void icache_destroy(struct inode_cache* ic);
+
+int icache_get(struct inode_cache* ic, int inode_num, struct inode* inode);
+
+void icache_fill(struct inode_cache* ic, int inode_num, const struct inode* inode);
+
+void icache_put(struct inode_cache* ic, int inode_num, const struct inode* inode);
+
+int icache_num_dirty(struct inode_cache* ic);
+
+void icache_clean(struct inode_cache* ic, int* inode_nums, struct inode* inodes);
+
+void icache_get_stats(struct inode_cache* ic, long* hits, long* misses);
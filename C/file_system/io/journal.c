@@ -0,0 +1,188 @@
+/**
+ * journal.c - The running transaction of the LLFS journal.
+ *
+ * Metadata blocks an operation changes don't go to their homes right
+ * away. File.c keeps the newest image of each one here until commit()
+ * logs them all, and answers reads of those blocks from here meanwhile.
+ * Blocks are kept in the order they were first changed, and found by
+ * number through a hash table. Every image has its own allocation, so a
+ * pointer to one stays good until the transaction is cleared.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+
+struct journal_block {
+	int block_num;
+	unsigned char* image;
+	struct journal_block* hnext;	// hash chain
+};
+
+struct journal_txn {
+	int block_size;
+
+	struct journal_block** blocks;	// in the order they were first changed
+	int count;
+	int capacity;
+
+	struct journal_block** buckets;
+	int num_buckets;	// a power of 2
+};
+
+
+static unsigned int block_hash(struct journal_txn* txn, int block_num) {
+
+	return ((unsigned int)block_num * 2654435761u) & (txn->num_buckets - 1);
+}
+
+
+struct journal_txn* jtxn_create(int block_size) {
+
+	struct journal_txn* txn = calloc(1, sizeof(struct journal_txn));
+	txn->block_size = block_size;
+	txn->num_buckets = 64;
+	txn->buckets = calloc(txn->num_buckets, sizeof(struct journal_block*));
+	return txn;
+}
+
+
+void jtxn_destroy(struct journal_txn* txn) {
+
+	if (txn == NULL) {
+		return;
+	}
+	jtxn_clear(txn);
+	free(txn->blocks);
+	free(txn->buckets);
+	free(txn);
+}
+
+
+static struct journal_block* find_block(struct journal_txn* txn, int block_num) {
+
+	for (struct journal_block* b = txn->buckets[block_hash(txn, block_num)]; b != NULL; b = b->hnext) {
+		if (b->block_num == block_num) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+
+// The newest image of a block, or NULL if the transaction hasn't changed it
+const unsigned char* jtxn_find(struct journal_txn* txn, int block_num) {
+
+	struct journal_block* b = find_block(txn, block_num);
+	return (b == NULL) ? NULL : b->image;
+}
+
+
+// Double the hash table once it's as full as it has buckets
+static void grow_buckets(struct journal_txn* txn) {
+
+	free(txn->buckets);
+	txn->num_buckets *= 2;
+	txn->buckets = calloc(txn->num_buckets, sizeof(struct journal_block*));
+
+	for (int i=0; i<txn->count; i++) {
+		unsigned int h = block_hash(txn, txn->blocks[i]->block_num);
+		txn->blocks[i]->hnext = txn->buckets[h];
+		txn->buckets[h] = txn->blocks[i];
+	}
+}
+
+
+// Record a block's new contents, replacing any image it already has
+void jtxn_put(struct journal_txn* txn, int block_num, const unsigned char* data) {
+
+	struct journal_block* b = find_block(txn, block_num);
+	if (b != NULL) {
+		memcpy(b->image, data, txn->block_size);
+		return;
+	}
+
+	if (txn->count == txn->capacity) {
+		txn->capacity = (txn->capacity == 0) ? 16 : txn->capacity * 2;
+		txn->blocks = realloc(txn->blocks, sizeof(struct journal_block*) * txn->capacity);
+	}
+	if (txn->count >= txn->num_buckets) {
+		grow_buckets(txn);
+	}
+
+	b = malloc(sizeof(struct journal_block));
+	b->block_num = block_num;
+	b->image = malloc(txn->block_size);
+	memcpy(b->image, data, txn->block_size);
+
+	unsigned int h = block_hash(txn, block_num);
+	b->hnext = txn->buckets[h];
+	txn->buckets[h] = b;
+	txn->blocks[txn->count++] = b;
+}
+
+
+// Forget a block's image, once the block's been freed and what it held
+// doesn't matter any more
+void jtxn_forget(struct journal_txn* txn, int block_num) {
+
+	struct journal_block** link = &txn->buckets[block_hash(txn, block_num)];
+	while (*link != NULL && (*link)->block_num != block_num) {
+		link = &(*link)->hnext;
+	}
+	if (*link == NULL) {
+		return;
+	}
+
+	struct journal_block* b = *link;
+	*link = b->hnext;
+
+	int i = 0;
+	while (txn->blocks[i] != b) {
+		i++;
+	}
+	memmove(txn->blocks + i, txn->blocks + i + 1, sizeof(struct journal_block*) * (txn->count - i - 1));
+	txn->count--;
+
+	free(b->image);
+	free(b);
+}
+
+
+int jtxn_count(struct journal_txn* txn) {
+
+	return txn->count;
+}
+
+
+// The i-th block the transaction changed: returns its number and points
+// image at its contents
+int jtxn_block(struct journal_txn* txn, int i, const unsigned char** image) {
+
+	*image = txn->blocks[i]->image;
+	return txn->blocks[i]->block_num;
+}
+
+
+// Forget every block, once they've been logged (or the transaction is lost)
+void jtxn_clear(struct journal_txn* txn) {
+
+	for (int i=0; i<txn->count; i++) {
+		free(txn->blocks[i]->image);
+		free(txn->blocks[i]);
+	}
+	txn->count = 0;
+	memset(txn->buckets, 0, sizeof(struct journal_block*) * txn->num_buckets);
+}
+
+
+// FNV-1a, carried on from sum, for checking a logged transaction is whole
+unsigned int journal_checksum(unsigned int sum, const unsigned char* data, int len) {
+
+	for (int i=0; i<len; i++) {
+		sum ^= data[i];
+		sum *= 16777619u;
+	}
+	return sum;
+}
@@ -0,0 +1,24 @@
+/**
+ * journal.h - The running transaction of the LLFS journal: metadata blocks
+ * changed since the last commit, waiting to be logged.
+ */
+
+struct journal_txn;
+
+struct journal_txn* jtxn_create(int block_size);
+
+void jtxn_destroy(struct journal_txn* txn);
+
+const unsigned char* jtxn_find(struct journal_txn* txn, int block_num);
+
+void jtxn_put(struct journal_txn* txn, int block_num, const unsigned char* data);
+
+void jtxn_forget(struct journal_txn* txn, int block_num);
+
+int jtxn_count(struct journal_txn* txn);
+
+int jtxn_block(struct journal_txn* txn, int i, const unsigned char** image);
+
+void jtxn_clear(struct journal_txn* txn);
+
+unsigned int journal_checksum(unsigned int sum, const unsigned char* data, int len);
@@ -0,0 +1,181 @@
+/**
+ * stats.c - Per-operation I/O counters and latency histograms for LLFS.
+ *
+ * File.c brackets every public operation with stats_op_begin() and
+ * stats_op_end(), and reports each block it reads or writes (tagged
+ * with the block's role) through stats_count_io().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char* op_names[NUM_OPS] = {
+	"none", "init", "make_dir", "make_datafile", "read_file", "delete_file", "sys_recover", "flush",
+	"open", "pread", "pwrite", "write_file",
+	"begin", "commit"
+};
+
+static const char* role_names[NUM_ROLES] = {
+	"superblock", "fbv", "inode_bitmap", "journal", "inode", "directory", "indirect", "data"
+};
+
+
+static long now_ns() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+void stats_reset(struct fs_stats* stats) {
+
+	memset(stats, 0, sizeof(struct fs_stats));
+	stats->current_op = OP_NONE;
+}
+
+
+void stats_op_begin(struct fs_stats* stats, int op) {
+
+	if (stats->depth++ > 0) {
+		return;
+	}
+
+	stats->current_op = op;
+	stats->start_ns = now_ns();
+}
+
+
+void stats_op_end(struct fs_stats* stats) {
+
+	if (--stats->depth > 0) {
+		return;
+	}
+
+	long elapsed = now_ns() - stats->start_ns;
+	struct op_stats* op = &stats->ops[stats->current_op];
+
+	op->calls++;
+	op->total_ns += elapsed;
+	if (elapsed > op->max_ns) {
+		op->max_ns = elapsed;
+	}
+
+	int bucket = 0;
+	for (long us = elapsed / 1000; us > 0 && bucket < LATENCY_BUCKETS-1; us >>= 1) {
+		bucket++;
+	}
+	op->latency[bucket]++;
+
+	stats->current_op = OP_NONE;
+}
+
+
+void stats_count_io(struct fs_stats* stats, int role, int write, int nblocks) {
+
+	struct op_stats* op = &stats->ops[stats->current_op];
+	if (write) {
+		op->writes[role] += nblocks;
+	} else {
+		op->reads[role] += nblocks;
+	}
+}
+
+
+static void print_text(struct fs_stats* stats, FILE* out) {
+
+	fprintf(out, "cache: %ld hits, %ld misses, %ld writebacks\n",
+			stats->cache_hits, stats->cache_misses, stats->cache_writebacks);
+	fprintf(out, "inode cache: %ld hits, %ld misses\n",
+			stats->inode_hits, stats->inode_misses);
+	fprintf(out, "dentry cache: %ld hits, %ld misses\n",
+			stats->dentry_hits, stats->dentry_misses);
+	fprintf(out, "path cache: %ld hits, %ld misses\n",
+			stats->path_hits, stats->path_misses);
+
+	for (int i=0; i<NUM_OPS; i++) {
+		struct op_stats* op = &stats->ops[i];
+
+		long total_io = 0;
+		for (int r=0; r<NUM_ROLES; r++) {
+			total_io += op->reads[r] + op->writes[r];
+		}
+		if (op->calls == 0 && total_io == 0) {
+			continue;
+		}
+
+		fprintf(out, "%s: %ld calls", op_names[i], op->calls);
+		if (op->calls > 0) {
+			fprintf(out, ", avg %.1f us, max %.1f us",
+					op->total_ns / 1000.0 / op->calls, op->max_ns / 1000.0);
+		}
+		fprintf(out, "\n");
+
+		for (int r=0; r<NUM_ROLES; r++) {
+			if (op->reads[r] || op->writes[r]) {
+				fprintf(out, "    %-12s  %6ld reads  %6ld writes\n",
+						role_names[r], op->reads[r], op->writes[r]);
+			}
+		}
+
+		if (op->calls > 0) {
+			fprintf(out, "    latency:");
+			for (int b=0; b<LATENCY_BUCKETS; b++) {
+				if (op->latency[b]) {
+					fprintf(out, " <%ldus:%ld", 1L << b, op->latency[b]);
+				}
+			}
+			fprintf(out, "\n");
+		}
+	}
+}
+
+
+static void print_json(struct fs_stats* stats, FILE* out) {
+
+	fprintf(out, "{\n  \"cache\": {\"hits\": %ld, \"misses\": %ld, \"writebacks\": %ld}",
+			stats->cache_hits, stats->cache_misses, stats->cache_writebacks);
+	fprintf(out, ",\n  \"inode_cache\": {\"hits\": %ld, \"misses\": %ld}",
+			stats->inode_hits, stats->inode_misses);
+	fprintf(out, ",\n  \"dentry_cache\": {\"hits\": %ld, \"misses\": %ld}",
+			stats->dentry_hits, stats->dentry_misses);
+	fprintf(out, ",\n  \"path_cache\": {\"hits\": %ld, \"misses\": %ld}",
+			stats->path_hits, stats->path_misses);
+
+	for (int i=0; i<NUM_OPS; i++) {
+		struct op_stats* op = &stats->ops[i];
+
+		fprintf(out, ",\n  \"%s\": {\"calls\": %ld, \"total_ns\": %ld, \"max_ns\": %ld,",
+				op_names[i], op->calls, op->total_ns, op->max_ns);
+
+		fprintf(out, "\n    \"reads\": {");
+		for (int r=0; r<NUM_ROLES; r++) {
+			fprintf(out, "%s\"%s\": %ld", r ? ", " : "", role_names[r], op->reads[r]);
+		}
+		fprintf(out, "},\n    \"writes\": {");
+		for (int r=0; r<NUM_ROLES; r++) {
+			fprintf(out, "%s\"%s\": %ld", r ? ", " : "", role_names[r], op->writes[r]);
+		}
+
+		// latency_us[i] counts calls under 2^i microseconds (and over the previous bucket)
+		fprintf(out, "},\n    \"latency_us\": [");
+		for (int b=0; b<LATENCY_BUCKETS; b++) {
+			fprintf(out, "%s%ld", b ? ", " : "", op->latency[b]);
+		}
+		fprintf(out, "]}");
+	}
+	fprintf(out, "\n}\n");
+}
+
+
+void stats_print(struct fs_stats* stats, FILE* out, int as_json) {
+
+	if (as_json) {
+		print_json(stats, out);
+	} else {
+		print_text(stats, out);
+	}
+}
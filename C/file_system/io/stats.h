@@ -0,0 +1,84 @@
+/**
+ * stats.h - Per-operation I/O counters and latency histograms for LLFS.
+ */
+
+#include <stdio.h>
+
+// File system operations we keep numbers for. OP_NONE covers block I/O
+// that happens outside any of them.
+enum fs_op {
+	OP_NONE,
+	OP_INIT,
+	OP_MAKE_DIR,
+	OP_MAKE_DATAFILE,
+	OP_READ_FILE,
+	OP_DELETE_FILE,
+	OP_RECOVER,
+	OP_FLUSH,
+	OP_OPEN,
+	OP_PREAD,
+	OP_PWRITE,
+	OP_WRITE_FILE,
+	OP_BEGIN,
+	OP_COMMIT,
+	NUM_OPS
+};
+
+// What a block is used for, decided from where it sits in the layout
+enum block_role {
+	ROLE_SUPERBLOCK,
+	ROLE_FBV,
+	ROLE_INODE_BITMAP,
+	ROLE_JOURNAL,		// write-ahead log of metadata changes
+	ROLE_INODE,
+	ROLE_DIRECTORY,
+	ROLE_INDIRECT,		// extent blocks of big data files
+	ROLE_DATA,
+	NUM_ROLES
+};
+
+// Latency buckets: bucket i counts calls taking [2^(i-1), 2^i) microseconds
+#define LATENCY_BUCKETS 24
+
+struct op_stats {
+	long calls;
+	long total_ns;
+	long max_ns;
+	long latency[LATENCY_BUCKETS];
+
+	long reads[NUM_ROLES];	// blocks, not requests
+	long writes[NUM_ROLES];
+};
+
+struct fs_stats {
+	struct op_stats ops[NUM_OPS];
+
+	// Copied from the buffer cache when the stats are printed
+	long cache_hits;
+	long cache_misses;
+	long cache_writebacks;
+
+	// Copied from the inode cache when the stats are printed
+	long inode_hits;
+	long inode_misses;
+
+	// ...and from the dentry and path caches
+	long dentry_hits;
+	long dentry_misses;
+	long path_hits;
+	long path_misses;
+
+	int current_op;
+	int depth;			// nested operations are counted as part of the outer one
+	long start_ns;
+};
+
+void stats_reset(struct fs_stats* stats);
+
+void stats_op_begin(struct fs_stats* stats, int op);
+
+void stats_op_end(struct fs_stats* stats);
+
+void stats_count_io(struct fs_stats* stats, int role, int write, int nblocks);
+
+void stats_print(struct fs_stats* stats, FILE* out, int as_json);